@@ -0,0 +1,200 @@
+#include "CCollisionEvents.h"
+#include "CObjectManager.h"
+
+#include <cstddef>
+
+#define INITIAL_PAIR_SLOTS 256
+
+static size_t HashPair(dBodyID b1, dBodyID b2)
+{
+	size_t h = (size_t)b1 * 2654435761u;
+	return h ^ ((size_t)b2 + 0x9e3779b9 + (h << 6) + (h >> 2));
+}
+
+CCollisionEvents::CCollisionEvents()
+{
+	for (int i = 0; i < 2; i++) {
+		m_sets[i].slots.resize(INITIAL_PAIR_SLOTS, -1);
+		m_sets[i].pairs.reserve(INITIAL_PAIR_SLOTS/2);
+		m_sets[i].mask = INITIAL_PAIR_SLOTS - 1;
+	}
+	m_current = &m_sets[0];
+	m_previous = &m_sets[1];
+	m_head = m_tail = 0;
+	m_dropped = 0;
+	m_step = 0;
+	m_reportPersist = false;
+}
+
+void CCollisionEvents::Clear(PairSet& set)
+{
+	int num = set.pairs.size();
+	for (int i = 0; i < num; i++) {
+		size_t s = HashPair(set.pairs[i].b1, set.pairs[i].b2) & set.mask;
+		while (set.slots[s] >= 0) {
+			set.slots[s] = -1;
+			s = (s + 1) & set.mask;
+		}
+	}
+	set.pairs.clear();
+}
+
+void CCollisionEvents::Grow(PairSet& set)
+{
+	int size = (set.mask + 1)*2;
+	set.slots.assign(size, -1);
+	set.mask = size - 1;
+	int num = set.pairs.size();
+	for (int i = 0; i < num; i++) {
+		size_t s = HashPair(set.pairs[i].b1, set.pairs[i].b2) & set.mask;
+		while (set.slots[s] >= 0) s = (s + 1) & set.mask;
+		set.slots[s] = i;
+	}
+}
+
+int CCollisionEvents::Find(PairSet& set, dBodyID b1, dBodyID b2)
+{
+	size_t s = HashPair(b1, b2) & set.mask;
+	while (set.slots[s] >= 0) {
+		const Pair& p = set.pairs[set.slots[s]];
+		if (p.b1 == b1 && p.b2 == b2) return set.slots[s];
+		s = (s + 1) & set.mask;
+	}
+	return -1;
+}
+
+void CCollisionEvents::Insert(PairSet& set, const Pair& pair)
+{
+	// keep the table at most half full
+	if ((int)(set.pairs.size() + 1)*2 > set.mask + 1) Grow(set);
+
+	size_t s = HashPair(pair.b1, pair.b2) & set.mask;
+	while (set.slots[s] >= 0) s = (s + 1) & set.mask;
+	set.slots[s] = set.pairs.size();
+	set.pairs.push_back(pair);
+}
+
+void CCollisionEvents::Push(CollisionEventType type, const Pair& pair)
+{
+	// full - lose the oldest event rather than the newest
+	if (m_head - m_tail >= EVENT_RING_SIZE) {
+		m_tail++;
+		m_dropped++;
+	}
+	CollisionEvent& e = m_ring[m_head & (EVENT_RING_SIZE-1)];
+	e.type = type;
+	e.step = m_step;
+	e.b1 = pair.b1;
+	e.b2 = pair.b2;
+	e.speed = pair.speed;
+	m_head++;
+}
+
+//-------------------------------------------------------------------
+//	Per step tracking
+//-------------------------------------------------------------------
+
+void CCollisionEvents::BeginStep()
+{
+	m_step++;
+}
+
+void CCollisionEvents::Touch(dBodyID b1, dBodyID b2)
+{
+	// only body/body pairs, the table itself isn't interesting
+	if (!b1 || !b2) return;
+	if (b2 < b1) { dBodyID t = b1; b1 = b2; b2 = t; }
+
+	if (Find(*m_current, b1, b2) >= 0) return;
+
+	int prev = Find(*m_previous, b1, b2);
+	Pair pair;
+	pair.b1 = b1;
+	pair.b2 = b2;
+	if (prev >= 0) {
+		pair.speed = m_previous->pairs[prev].speed;
+		if (m_reportPersist) Push(CE_Persist, pair);
+	} else {
+		const dReal* v1 = dBodyGetLinearVel(b1);
+		const dReal* v2 = dBodyGetLinearVel(b2);
+		dReal s1 = v1[0]*v1[0] + v1[1]*v1[1] + v1[2]*v1[2];
+		dReal s2 = v2[0]*v2[0] + v2[1]*v2[1] + v2[2]*v2[2];
+		pair.speed = (s1 > s2) ? s1 : s2;
+		Push(CE_Begin, pair);
+	}
+	Insert(*m_current, pair);
+}
+
+void CCollisionEvents::EndStep()
+{
+	int num = m_previous->pairs.size();
+	for (int i = 0; i < num; i++) {
+		const Pair& p = m_previous->pairs[i];
+		if (Find(*m_current, p.b1, p.b2) >= 0) continue;
+
+		// two sleepers aren't collided at all, but they're still touching
+		if (!dBodyIsEnabled(p.b1) && !dBodyIsEnabled(p.b2)) {
+			Insert(*m_current, p);
+			continue;
+		}
+		Push(CE_End, p);
+	}
+
+	Clear(*m_previous);
+	PairSet* t = m_previous;
+	m_previous = m_current;
+	m_current = t;
+}
+
+void CCollisionEvents::RingOut(dBodyID b, dReal speed)
+{
+	Pair pair;
+	pair.b1 = b;
+	pair.b2 = 0;
+	pair.speed = speed;
+	Push(CE_RingOut, pair);
+}
+
+bool CCollisionEvents::PopEvent(CollisionEvent& e)
+{
+	if (m_tail == m_head) return false;
+	e = m_ring[m_tail & (EVENT_RING_SIZE-1)];
+	m_tail++;
+	return true;
+}
+
+//-------------------------------------------------------------------
+//	Snapshots
+//-------------------------------------------------------------------
+
+void CCollisionEvents::SaveTouching(std::vector<TouchingPair>& out)
+{
+	int num = m_previous->pairs.size();
+	out.resize(num);
+	for (int i = 0; i < num; i++) {
+		const Pair& p = m_previous->pairs[i];
+		out[i].h1 = (unsigned int)(size_t)dBodyGetData(p.b1);
+		out[i].h2 = (unsigned int)(size_t)dBodyGetData(p.b2);
+		out[i].speed = p.speed;
+	}
+}
+
+void CCollisionEvents::RestoreTouching(const std::vector<TouchingPair>& in, int step, CObjectManager& om)
+{
+	Clear(*m_current);
+	Clear(*m_previous);
+	for (unsigned int i = 0; i < in.size(); i++) {
+		CGameObject* o1 = om.getObject((ObjectHandle)in[i].h1);
+		CGameObject* o2 = om.getObject((ObjectHandle)in[i].h2);
+		if (!o1 || !o2) continue;
+		// another world's bodies can sort the other way round
+		Pair pair;
+		pair.b1 = o1->getBodyID();
+		pair.b2 = o2->getBodyID();
+		if (pair.b2 < pair.b1) { dBodyID t = pair.b1; pair.b1 = pair.b2; pair.b2 = t; }
+		pair.speed = in[i].speed;
+		Insert(*m_previous, pair);
+	}
+	m_head = m_tail = 0;
+	m_step = step;
+}
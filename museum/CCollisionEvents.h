@@ -0,0 +1,112 @@
+//-------------------------------------------------------------------
+//	CCollisionEvents
+//
+//	Tracks which pairs of bodies are touching from step to step and
+//	turns that into begin/end events in a fixed size ring.  Gameplay
+//	and sound drain the ring once per step instead of being called
+//	from inside the collide pass, and a resting contact only makes
+//	an event when it starts and when it stops.
+//-------------------------------------------------------------------
+#ifndef CCOLLISION_EVENTS_H
+#define CCOLLISION_EVENTS_H
+
+#include <ode/ode.h>
+#include <vector>
+
+#define EVENT_RING_SIZE 4096	// must be a power of two
+
+typedef enum {
+	CE_Begin,		// pair started touching this step
+	CE_Persist,		// still touching (only if asked for)
+	CE_End,			// pair stopped touching this step
+	CE_RingOut		// b1 left the ring this step (b2 is 0)
+} CollisionEventType;
+
+struct CollisionEvent
+{
+	CollisionEventType	type;
+	int					step;
+	dBodyID				b1;
+	dBodyID				b2;
+	dReal				speed;		// faster body's squared speed at first touch
+									// (for CE_RingOut, b1's squared speed)
+};
+
+// a touching pair as a snapshot keeps it: by object handle, since the
+// snapshot may be restored into another world with the same objects
+struct TouchingPair
+{
+	unsigned int		h1;			// ObjectHandle
+	unsigned int		h2;
+	dReal				speed;
+};
+
+class CObjectManager;
+
+class CCollisionEvents
+{
+public:
+	CCollisionEvents();
+
+	void	BeginStep();
+	// a contact was made between two bodies (any number of times a step)
+	void	Touch(dBodyID b1, dBodyID b2);
+	void	EndStep();
+	// not a collision, but gameplay wants it in the same order
+	void	RingOut(dBodyID b, dReal speed);
+
+	bool	PopEvent(CollisionEvent& e);
+	int		getNumEvents() { return m_head - m_tail; }
+	int		getNumDropped() { return m_dropped; }
+	int		getNumTouching() { return m_previous->pairs.size(); }	// as of the last step
+
+	void	setReportPersist(bool report) { m_reportPersist = report; }
+
+	// the pairs touching as of the last step, and the step count, for
+	// snapshots; restoring finds the bodies through the manager of the
+	// world being restored, and drops any events still waiting in the ring
+	void	SaveTouching(std::vector<TouchingPair>& out);
+	void	RestoreTouching(const std::vector<TouchingPair>& in, int step, CObjectManager& om);
+	int		getStep() { return m_step; }
+
+	// the pair sets' capacity added up, which only goes up when they grow
+	size_t	getCapacity() {
+		return m_sets[0].slots.capacity() + m_sets[0].pairs.capacity() +
+			m_sets[1].slots.capacity() + m_sets[1].pairs.capacity();
+	}
+
+private:
+	struct Pair
+	{
+		dBodyID	b1, b2;
+		dReal	speed;
+	};
+
+	// open addressing set of pairs, plus the list of what's in it so
+	// clearing and walking it only cost as much as the contacts
+	struct PairSet
+	{
+		std::vector<int>	slots;		// index into pairs, -1 for empty
+		std::vector<Pair>	pairs;
+		int					mask;
+	};
+
+	void	Clear(PairSet& set);
+	void	Grow(PairSet& set);
+	int		Find(PairSet& set, dBodyID b1, dBodyID b2);
+	void	Insert(PairSet& set, const Pair& pair);
+	void	Push(CollisionEventType type, const Pair& pair);
+
+	PairSet			m_sets[2];
+	PairSet*		m_current;		// touching this step
+	PairSet*		m_previous;		// touching last step
+
+	CollisionEvent	m_ring[EVENT_RING_SIZE];
+	int				m_head;			// next write
+	int				m_tail;			// next read
+	int				m_dropped;
+	int				m_step;
+	bool			m_reportPersist;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "CContactArena.h"
+#include "CThreads.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#define ALLOC_BUCKETS 64	// distinct block sizes we'll keep
+
+CContactArena::CContactArena()
+{
+	m_count = 0;
+	m_lastCount = 0;
+	m_grows = 0;
+}
+
+void CContactArena::Grow(int size)
+{
+	m_contacts.resize(size);
+	m_bodies.resize(size);
+	m_grows++;
+}
+
+void CContactArena::Begin()
+{
+	m_count = 0;
+	int want = (int)(m_lastCount*ARENA_HEADROOM);
+	if (want > (int)m_contacts.size())
+		Grow(want);
+}
+
+dContact* CContactArena::Add(dBodyID b1, dBodyID b2)
+{
+	if (m_count == (int)m_contacts.size())
+		Grow(m_count < 16 ? 32 : m_count*2);
+	m_bodies[m_count].b1 = b1;
+	m_bodies[m_count].b2 = b2;
+	return &m_contacts[m_count++];
+}
+
+void CContactArena::Flush(dWorldID world, dJointGroupID group)
+{
+	for (int i = 0; i < m_count; i++) {
+		dJointID c = dJointCreateContact(world, group, &m_contacts[i]);
+		dJointAttach(c, m_bodies[i].b1, m_bodies[i].b2);
+	}
+	m_lastCount = m_count;
+}
+
+//-------------------------------------------------------------------
+//	ODE allocation hooks
+//
+//	A free list per block size, per thread.  Blocks are whatever malloc
+//	gave us, so anything ODE allocated before the hooks went in, or on
+//	another thread, can be freed through them too.
+//-------------------------------------------------------------------
+
+struct AllocBucket
+{
+	size_t				size;
+	std::vector<void*>	blocks;
+};
+
+struct ThreadArena
+{
+	AllocBucket	buckets[ALLOC_BUCKETS];
+	int			numBuckets;
+	int			heapAllocs;
+	int			recycledAllocs;
+};
+
+// made the first time a thread allocates, since a thread local can't
+// have a constructor
+static THREAD_LOCAL ThreadArena* s_arena = 0;
+
+static ThreadArena* GetArena()
+{
+	if (!s_arena) {
+		s_arena = new ThreadArena;
+		s_arena->numBuckets = 0;
+		s_arena->heapAllocs = 1;		// itself
+		s_arena->recycledAllocs = 0;
+	}
+	return s_arena;
+}
+
+static AllocBucket* FindBucket(ThreadArena* arena, size_t size, bool create)
+{
+	for (int i = 0; i < arena->numBuckets; i++)
+		if (arena->buckets[i].size == size) return &arena->buckets[i];
+	if (!create || arena->numBuckets == ALLOC_BUCKETS) return 0;
+	arena->buckets[arena->numBuckets].size = size;
+	return &arena->buckets[arena->numBuckets++];
+}
+
+static void* ArenaAlloc(size_t size)
+{
+	ThreadArena* arena = GetArena();
+	AllocBucket* b = FindBucket(arena, size, false);
+	if (b && !b->blocks.empty()) {
+		void* p = b->blocks.back();
+		b->blocks.pop_back();
+		arena->recycledAllocs++;
+		return p;
+	}
+	arena->heapAllocs++;
+	return malloc(size);
+}
+
+// a free list only has to grow when more blocks of its size are
+// free at once than ever were; that's a heap allocation like any other
+static void ArenaFree(void* ptr, size_t size)
+{
+	if (!ptr) return;
+	ThreadArena* arena = GetArena();
+	AllocBucket* b = FindBucket(arena, size, true);
+	if (!b) {
+		free(ptr);
+		return;
+	}
+	if (b->blocks.size() == b->blocks.capacity())
+		arena->heapAllocs++;
+	b->blocks.push_back(ptr);
+}
+
+static void* ArenaRealloc(void* ptr, size_t oldSize, size_t newSize)
+{
+	void* p = ArenaAlloc(newSize);
+	if (ptr) {
+		memcpy(p, ptr, (oldSize < newSize) ? oldSize : newSize);
+		ArenaFree(ptr, oldSize);
+	}
+	return p;
+}
+
+void CContactArena::InstallAllocHooks()
+{
+	dSetAllocHandler(&ArenaAlloc);
+	dSetReallocHandler(&ArenaRealloc);
+	dSetFreeHandler(&ArenaFree);
+}
+
+void CContactArena::ReleaseThread()
+{
+	if (!s_arena) return;
+	for (int i = 0; i < s_arena->numBuckets; i++) {
+		std::vector<void*>& blocks = s_arena->buckets[i].blocks;
+		for (unsigned int j = 0; j < blocks.size(); j++)
+			free(blocks[j]);
+	}
+	delete s_arena;
+	s_arena = 0;
+}
+
+int CContactArena::getHeapAllocs()
+{
+	return GetArena()->heapAllocs;
+}
+
+int CContactArena::getRecycledAllocs()
+{
+	return GetArena()->recycledAllocs;
+}
+
+int CContactArena::getCachedBlocks()
+{
+	ThreadArena* arena = GetArena();
+	int num = 0;
+	for (int i = 0; i < arena->numBuckets; i++)
+		num += arena->buckets[i].blocks.size();
+	return num;
+}
@@ -0,0 +1,68 @@
+//-------------------------------------------------------------------
+//	CContactArena
+//
+//	Holds a step's contacts until the collide pass is over, then
+//	turns them into joints in one go.  The buffer never shrinks and
+//	is reserved from the last step's count, so a settled rack makes
+//	no allocations of its own.
+//
+//	ODE's joint group and step memory come from dAlloc, so the arena
+//	also installs ODE alloc handlers that keep freed blocks for reuse
+//	by size instead of handing them back to the heap.  ODE frees its
+//	joint arenas every step and asks for the same sizes again next
+//	step, so after warm-up those come straight off the free lists.
+//	Every thread has free lists and counts of its own, so worlds
+//	stepping on different threads never wait on each other; ODE
+//	makes a step's memory on the thread that calls dWorldStep, so
+//	what that thread's count goes up by over a step is that world's.
+//-------------------------------------------------------------------
+#ifndef CCONTACT_ARENA_H
+#define CCONTACT_ARENA_H
+
+#include <ode/ode.h>
+#include <vector>
+
+#define ARENA_HEADROOM 1.25	// reserve this much more than last step's contacts
+
+class CContactArena
+{
+public:
+	CContactArena();
+
+	void		Begin();
+	// a contact to fill in, attached to b1/b2 when Flush makes the joints
+	dContact*	Add(dBodyID b1, dBodyID b2);
+	void		Flush(dWorldID world, dJointGroupID group);
+
+	int			getNumContacts() { return m_count; }
+	dBodyID		getBody1(int i) { return m_bodies[i].b1; }
+	dBodyID		getBody2(int i) { return m_bodies[i].b2; }
+	int			getHighWater() { return m_contacts.size(); }
+	int			getNumGrows() { return m_grows; }
+
+	// the ODE allocation hooks; install once before the world is made
+	static void	InstallAllocHooks();
+	// hands the calling thread's free lists back to the heap; for a
+	// thread that's about to exit
+	static void	ReleaseThread();
+	// the calling thread's, since it started
+	static int	getHeapAllocs();		// went to malloc
+	static int	getRecycledAllocs();	// came off a free list
+	static int	getCachedBlocks();
+
+private:
+	struct Attach
+	{
+		dBodyID	b1, b2;
+	};
+
+	void		Grow(int size);
+
+	std::vector<dContact>	m_contacts;
+	std::vector<Attach>		m_bodies;
+	int			m_count;
+	int			m_lastCount;
+	int			m_grows;
+};
+
+#endif
@@ -195,6 +195,28 @@ CGLRender::drawAim(double x, double z, double throb)
 	glPopMatrix();
 
 }
+void
+CGLRender::drawPath(const double* points, int numPoints, const double* contact, double radius)
+{
+	glDisable(GL_TEXTURE_2D);
+	glColor3d(1.0, 1.0, 0.4);
+	glLineWidth(2.0);
+	glBegin(GL_LINE_STRIP);
+	for (int i = 0; i < numPoints; i++)
+		glVertex3d(points[i*3], points[i*3+1], points[i*3+2]);
+	glEnd();
+
+	if (contact) {
+		glColor3d(1.0, 0.3, 0.3);
+		glBegin(GL_LINE_LOOP);
+		for (double x = 1; x >= 0.0; x -= .02)
+			glVertex3d(contact[0] + radius*cos(x*2.0*M_PI), contact[1], contact[2] + radius*sin(x*2.0*M_PI));
+		glEnd();
+	}
+	glLineWidth(1.0);
+	glEnable(GL_TEXTURE_2D);
+}
+
 void CGLRender::drawFloor()
 {	
 	//glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);	// Clear The Screen And The Depth Buffer
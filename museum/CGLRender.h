@@ -46,6 +46,8 @@ public:
 	void drawSphere();
 	void drawSphere(const double pos[3], const double R[12], double radius);
 	void drawAim(double,double,double);
+	// a predicted path, numPoints positions, and a ring where it hits (or 0)
+	void drawPath(const double* points, int numPoints, const double* contact, double radius);
 	void drawFloor();
 	void drawGrid();
 
@@ -53,6 +55,7 @@ public:
 	int getWidth () { return m_width; }
 
 	HDC getHDC () { return hDC; }
+	void setTitle (const char* title) { SetWindowText(hWnd, title); }
 
 private:
 	void CreateTexture(UINT textureArray[], LPSTR strFileName, int textureID);
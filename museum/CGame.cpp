@@ -1,6 +1,7 @@
 #include "CGame.h"
 #include "CGLRender.h"
 #include "CObjectManager.h"
+#include "CMarbleSim.h"
 #include "CMarble.h"
 #include "CInputManager.h"
 
@@ -9,9 +10,15 @@
 #include <stdio.h>
 #include <cmath>
 
+#ifdef _MSC_VER
+#define snprintf _snprintf	// which doesn't terminate a string it cuts short
+#endif
+
 #define NUM_MARBLES 25
 #define LEFT_MB		0
 #define RIGHT_MB	2
+#define REPLAY_FILE	"last.replay"	// every session is recorded over the last
+#define PREVIEW_BUDGET	0.002		// seconds of each frame the shot preview may have
 
 CGame::CGame()
 {	
@@ -34,10 +41,18 @@ CGame::CGame()
 	m_gameState = GS_LoadLevel;
 	m_tolleyPos.set(-20, 0, 50);
 	m_aimPos.set(0,0,0);
-	m_p1Tolley = new CTolley;
-	m_objectManager.AddObject(m_p1Tolley);
-	m_marbleList.push_back(m_p1Tolley);
-	m_p1Tolley->setPos(m_tolleyPos.x, 1, m_tolleyPos.z);
+	m_p1Tolley = m_sim.getTolley();
+	m_p2Tolley = m_sim.AddTolley();		// before the recorder, which notes how many
+	m_p1Score = m_p2Score = 0;
+	m_turn = 1;
+	m_shotTaken = false;
+	m_aiLevel = AI_Normal;
+	m_sim.setCollisionListener(this);
+	m_sim.getODEManager().setAdaptiveStep(true);
+	if (m_recorder.Open(REPLAY_FILE, m_sim, time, NUM_MARBLES))
+		m_sim.setRecorder(&m_recorder);
+	m_sim.PlaceTolley(m_p1Tolley, m_tolleyPos.x, 1, m_tolleyPos.z);
+	m_sim.PlaceTolley(m_p2Tolley, -m_tolleyPos.x, 1, m_tolleyPos.z);
 	m_soundManager.init();
 	//m_soundManager.startMusic();
 	//m_p1Tolley->DisableBody();
@@ -45,7 +60,8 @@ CGame::CGame()
 
 CGame::~CGame()
 {
-	;
+	m_sim.setRecorder(0);
+	m_recorder.Close();
 }
 
 //========================================================================================
@@ -55,21 +71,9 @@ CGame::~CGame()
 bool
 CGame::CreateMarbles(int number)
 {
-	CMarble* temp = NULL;
-	for (int i = 0; i < number; i++)
-		m_marbleList.push_back((CMarble*)m_objectManager.CreateObject(Marble_Type));
-	
-	double x = m_marbleList[1]->getRadius()*2;
-
-	int cols = (int)sqrt((double)number)+1;
-	int z = 0;
-	for (int i = 0; i < cols; i++) 
-		for (int j = 0; j < cols; j++) {
-			m_marbleList[z++]->setPos((cols/2-i)*x, x/2, (cols/2-j)*x);
-			if (z >= number) return true;
-		}
-
-	return true;
+	m_preview.CreateMarbles(number, m_sim.getNumTolleys());
+	m_ai.CreateMarbles(number, m_sim.getNumTolleys());
+	return m_sim.CreateMarbles(number);
 }
 
 WPARAM
@@ -122,6 +126,11 @@ CGame::MainLoop ()
 {
 	if (CInputManager::Instance().KeyState(VK_F2)) SoundManager::Instance().startMusic();
 	if (CInputManager::Instance().KeyState(VK_F3)) SoundManager::Instance().stopMusic();
+	if (CInputManager::Instance().KeyState(VK_F4)) {
+		CInputManager::Instance().KeyUp(VK_F4);
+		m_aiLevel = (AILevel)((m_aiLevel + 1) % AI_NumLevels);
+		ShowScore();
+	}
 	int width = CGLRender::Instance().getWidth() >> 1;
 	int height = CGLRender::Instance().getHeight() >> 1;
 	if (m_gameState == GS_Menu) {
@@ -144,35 +153,58 @@ CGame::MainLoop ()
 		if (m_throbber < 0.0 || m_throbber > 1.0) m_throbIncrSign = -m_throbIncrSign;
 		m_throbber += m_deltaT*m_throbIncrSign;
 
-		ODEManager::Instance().SimLoop(m_pause);
+		m_sim.Update(m_deltaT, m_pause);
 		if (m_gameState == GS_DynamicsSettle) 
 		{	
 			interpView();
 
-			if (CObjectManager::Instance().DynamicsDone())
+			ShowScore();
+
+			if (m_sim.DynamicsDone()) {
 				m_gameState = GS_AimShot;
+				if (m_shotTaken)
+					EndTurn();
+				if (m_turn == 1)
+					m_preview.setTable(m_sim);
+				else
+					m_ai.Begin(m_sim, m_p2Tolley, CShotSearch::getBudget(m_aiLevel), rand());
+				ShowScore();
+			}
 			
 		} 
 		else if (m_gameState == GS_AimShot) 
 		{
 
 			double speed = m_deltaT*5;
-			if (!CObjectManager::Instance().DynamicsDone()) {
+			if (!m_sim.DynamicsDone()) {
 				m_gameState = GS_DynamicsSettle;
 				m_viewInterp = 0.0;
 			}
-			if (CInputManager::Instance().MouseState(LEFT_MB)) {
+			if (m_turn == 2) {
+				// the computer's turn: it thinks on its own threads, and once
+				// it's done we take the best shot it found
+				if (m_gameState == GS_AimShot && m_ai.Poll()) {
+					const ShotChoice& best = m_ai.getBest();
+					m_aimPos = m_tolleyPos + best.aim;
+					m_aimPos.y = 0;
+					ShootMarble(best.forward, best.side, best.aim);
+					m_viewInterp = 0.0;
+				}
+			}
+			else if (CInputManager::Instance().MouseState(LEFT_MB)) {
 				m_gameState = GS_ShotDetect;
 				ShowCursor(FALSE);
 				SetCursorPos(width, height);
 				m_forwardAim.set(0,0,0);
 				m_sideAim.set(0,0,0);
 			}
-			if (CInputManager::Instance().KeyState(VK_SPACE)) {
+			if (m_turn == 1 && CInputManager::Instance().KeyState(VK_SPACE)) {
 				m_toggleTolleyMove = !m_toggleTolleyMove;
 				CInputManager::Instance().KeyUp(VK_SPACE);
 			} 
-			if (m_toggleTolleyMove) {
+			if (m_turn == 2)
+				;	// hands off the computer's tolley
+			else if (m_toggleTolleyMove) {
 				if (CInputManager::Instance().KeyState(VK_UP))		m_tolleyPos = m_tolleyPos - m_tolleyForward*speed;
 				if (CInputManager::Instance().KeyState(VK_DOWN))	m_tolleyPos = m_tolleyPos + m_tolleyForward*speed;
 				if (CInputManager::Instance().KeyState(VK_LEFT))	m_tolleyPos = m_tolleyPos + m_tolleyStrafe*speed;
@@ -183,7 +215,14 @@ CGame::MainLoop ()
 				if (CInputManager::Instance().KeyState(VK_LEFT))	m_aimPos = m_aimPos + m_tolleyStrafe*speed*1.5;
 				if (CInputManager::Instance().KeyState(VK_RIGHT))	m_aimPos = m_aimPos - m_tolleyStrafe*speed*1.5;
 			}
-			m_p1Tolley->setPos(m_tolleyPos.x, m_tolleyPos.y, m_tolleyPos.z);
+			if (m_turn == 1) {
+				m_sim.PlaceTolley(m_p1Tolley, m_tolleyPos.x, m_tolleyPos.y, m_tolleyPos.z);
+
+				// the spin is only put on after the click, so the preview is without
+				CVector3 none(0, 0, 0);
+				m_preview.Aim(m_tolleyPos, none, none, m_aimPos - m_tolleyPos);
+				m_preview.Refine(PREVIEW_BUDGET);
+			}
 	
 			CCamera::Instance().LookAt(m_tolleyPos.x + m_tolleyForward.x*10 , 5, m_tolleyPos.z + m_tolleyForward.z*10,
 										m_aimPos.x, m_aimPos.y, m_aimPos.z,
@@ -205,15 +244,16 @@ CGame::MainLoop ()
 		
 		
 		CCamera::Instance().Look();
-		m_tolleyPos.set(m_p1Tolley->getPos()[0],
-						m_p1Tolley->getPos()[1], 
-						m_p1Tolley->getPos()[2]);
-		CObjectManager::Instance().UpdateObjects();
-		CObjectManager::Instance().DrawObjects();
+		const double* tolleyPos = ((m_turn == 1) ? m_p1Tolley : m_p2Tolley)->getPos();
+		m_tolleyPos.set(tolleyPos[0], tolleyPos[1], tolleyPos[2]);
+		m_sim.getObjectManager().DrawObjects();
 		//CGLRender::Instance().drawGrid();
 		CGLRender::Instance().drawFloor();
 		
 		CGLRender::Instance().drawAim(m_aimPos.x, m_aimPos.z, m_throbber);
+		if (m_gameState == GS_AimShot && m_turn == 1)
+			CGLRender::Instance().drawPath(m_preview.getPath(), m_preview.getNumPoints(),
+										   m_preview.hasContact() ? m_preview.getContact() : 0, TOLLEY_RADIUS);
 	}
 
 }
@@ -251,30 +291,63 @@ void CGame::interpView ()
 							   0, 1, 0);
 }
 
+//-------------------------------------------------------------------
+//	The sim tells us when marbles crack together
+//-------------------------------------------------------------------
 void 
-CGame::CheckCollisions(dBodyID b1, dBodyID b2)
+CGame::OnImpact(CMarble* m1, CMarble* m2, double speed)
 {
-	CGameObject* obj1 = CObjectManager::Instance().getObject(b1);
-	CGameObject* obj2 = CObjectManager::Instance().getObject(b2);
+	m_shot.OnImpact(m1, m2, speed);
+	m_soundManager.playFX((float)speed * 2.0f);
+}
 
-	if (((CMarble*)obj1)->getVel() > 0.3 || ((CMarble*)obj2)->getVel() > 0.3)	{		
-		float volume = max(((CMarble*)obj1)->getVel(), ((CMarble*)obj2)->getVel());
-		m_soundManager.playFX(volume * 2.0f);
-	}
+void
+CGame::OnRingOut(CMarble* m)
+{
+	m_shot.OnRingOut(m);
 }
+
 void
 CGame::ShootMarble(CVector3 forward, CVector3 side, CVector3 aim)
 {
-	double yVel = aim.Magnitude()/30.0;
-	if (yVel > 5.0) yVel = 10.0;
-	m_p1Tolley->setVel(aim.x*1.3,yVel, aim.z*1.3);
-	if (forward.Magnitude() != 0)
-		m_p1Tolley->AddTorque(forward.x/10, forward.y/10, forward.z/10);
-	if (side.Magnitude() != 0)
-		m_p1Tolley->AddTorque(side.x/3, side.y/3, side.z/3);
+	CTolley* tolley = (m_turn == 1) ? m_p1Tolley : m_p2Tolley;
+	m_shot.Reset(tolley);
+	m_shotTaken = true;
+	m_sim.ShootMarble(tolley, forward, side, aim);
 	m_gameState = GS_DynamicsSettle;
 }
 
+//-------------------------------------------------------------------
+//	Hitting exactly one marble scores for the shooter
+//-------------------------------------------------------------------
+void
+CGame::EndTurn()
+{
+	if (m_turn == 1)
+		m_p1Score += m_shot.getShooterPoints();
+	else
+		m_p2Score += m_shot.getShooterPoints();
+	m_turn = (m_turn == 1) ? 2 : 1;
+	m_shotTaken = false;
+}
+
+void
+CGame::ShowScore()
+{
+	// the only thing that sets the title; while the table settles it
+	// also says how hard the physics is working
+	char title[128];
+	if (m_gameState == GS_DynamicsSettle)
+		snprintf(title, sizeof(title), "%s - you %d, computer (%s) %d - %.0f steps/s, %.0f per sim second",
+				 m_windowTitle, m_p1Score, CShotSearch::getLevelName(m_aiLevel), m_p2Score,
+				 m_sim.getODEManager().getStepRate(), m_sim.getODEManager().getSimStepRate());
+	else
+		snprintf(title, sizeof(title), "%s - you %d, computer (%s) %d", m_windowTitle,
+				 m_p1Score, CShotSearch::getLevelName(m_aiLevel), m_p2Score);
+	title[sizeof(title) - 1] = 0;
+	CGLRender::Instance().setTitle(title);
+}
+
 void
 CGame::OnKeyUp(WPARAM w)
 {
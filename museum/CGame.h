@@ -5,8 +5,9 @@
 #include "CGLRender.h"
 #include "CCamera.h"
 #include "CTimer.h"
-#include "ODEManager.h"
-#include "CObjectManager.h"
+#include "CMarbleSim.h"
+#include "CShotPreview.h"
+#include "CShotSearch.h"
 #include "CMarble.h"
 #include "ObjectFactory.h"
 #include "CInputManager.h"
@@ -37,7 +38,7 @@ public:
 	char* text;
 };
 
-class CGame : public Singleton<CGame>
+class CGame : public Singleton<CGame>, public CCollisionListener
 {
 public:
 	CGame();
@@ -49,17 +50,22 @@ public:
 	void OnKeyDown(WPARAM w);
 	// Game Functions
 	bool CreateMarbles (int number);
-	void CheckCollisions(dBodyID, dBodyID);
+	virtual void OnImpact(CMarble* m1, CMarble* m2, double speed);
+	virtual void OnRingOut(CMarble* m);
 	void Finish () { m_quit = true; }
 
 private:
 	void interpView ();
 	void MainLoop();
 	void ShootMarble(CVector3 forward, CVector3 side, CVector3 aim);
-	std::vector<CMarble*> m_marbleList;
+	// scores the shot that's just settled and hands over to the other player
+	void EndTurn();
+	void ShowScore();
 	
 	// a Tolley is the larger marble with which
-	// the player shoots. 
+	// the player shoots.  Each player has their
+	// own, and it stays wherever their last shot
+	// left it.
 	CTolley*		m_p1Tolley;
 	CTolley*		m_p2Tolley;
 	// Vectors for keeping track of the
@@ -76,14 +82,20 @@ private:
 	CTimer			m_timer;
 	CGLRender		m_renderer;
 	CCamera			m_camera;
-	CObjectManager	m_objectManager;
-	ODEManager		m_odeManager;
+	CMarbleSim		m_sim;
+	CReplayRecorder	m_recorder;		// after m_sim, so it's closed first
+	CShotPreview	m_preview;		// where the shot being aimed will go
+	CShotSearch		m_ai;			// player 2
+	CShotOutcome	m_shot;			// what the shot in play has done
 	CInputManager	m_inputManager;
 	GameState		m_gameState;
 	SoundManager	m_soundManager;
 
 	int				m_p1Score;
 	int				m_p2Score;
+	int				m_turn;			// 1 or 2
+	bool			m_shotTaken;	// the table's settling after a shot, not just settling
+	AILevel			m_aiLevel;
 
 	double			m_throbber; // just a float that will go between 1-0 and back w/ time
 	double			m_throbIncrSign;
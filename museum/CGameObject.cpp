@@ -1,14 +1,18 @@
 #include "CGameObject.h"
+#include "CObjectManager.h"
+#include "CMarbleSim.h"
 #include <ode/ode.h>
-#include "CGame.h"
 #include <string>
 
-CGameObject::CGameObject()
+CGameObject::CGameObject(CMarbleSim& world) : m_world(world)
 {
-	m_body = ODEManager::Instance().createBody(); 
+	m_body = ODE().createBody(); 
 	m_dynamic = true;
 	//m_texture=0;
 	m_odeDestroyed = false;
+	m_handle = INVALID_HANDLE;
+	Objects().Register(this);
+	StorePhysicsState();
 }
 
 CGameObject::~CGameObject()
@@ -32,19 +36,46 @@ dBodyID CGameObject::getBodyID()
 	return m_body;
 }
 	
+CObjectManager& CGameObject::Objects()
+{
+	return m_world.getObjectManager();
+}
+
+ODEManager& CGameObject::ODE()
+{
+	return m_world.getODEManager();
+}
+
+int CGameObject::getIndex()
+{
+	return Objects().getIndex(m_handle);
+}
+
+CObjectState& CGameObject::State()
+{
+	return Objects().getState();
+}
+
+const double* CGameObject::getColor()
+{
+	return &State().color[getIndex()*4];
+}
+
 void CGameObject::setColor(double r, double g, double b, double a)
 {
-	m_color[0] = r;
-	m_color[1] = g;
-	m_color[2] = b;
-	m_color[3] = a;
+	double* color = &State().color[getIndex()*4];
+	color[0] = r;
+	color[1] = g;
+	color[2] = b;
+	color[3] = a;
 }
 
 void CGameObject::setColor(double r, double g, double b)
 {
-	m_color[0] = r;
-	m_color[1] = g;
-	m_color[2] = b;
+	double* color = &State().color[getIndex()*4];
+	color[0] = r;
+	color[1] = g;
+	color[2] = b;
 }
 
 void CGameObject::DisableGravity()
@@ -74,14 +105,25 @@ void CGameObject::setTexture(char* fileName)
 
 void CGameObject::DisableBody()
 {
+	Objects().SleepObject(this);
 	m_dynamic=false;
-	dBodyDisable(m_body);
 }
 
 void CGameObject::EnableBody()
 {
 	m_dynamic=true;
-	dBodyEnable(m_body);
+	Wake();
+}
+
+bool CGameObject::isAsleep()
+{
+	return m_dynamic && !Objects().isActive(m_handle);
+}
+
+void CGameObject::Wake()
+{
+	if (isAsleep())
+		Objects().WakeObject(this);
 }
 
 void CGameObject::DestroyODEObject()
@@ -92,4 +134,25 @@ void CGameObject::DestroyODEObject()
 		dGeomDestroy(m_geom);
 		dBodyDestroy(m_body);
 	}
-}
\ No newline at end of file
+}
+
+//-------------------------------------------------------------------
+//	Remember the body transform before a physics step
+//-------------------------------------------------------------------
+
+void CGameObject::StorePhysicsState()
+{
+	if (m_odeDestroyed) return;
+	int index = getIndex();
+	if (index >= 0)
+		Objects().StorePhysicsState(index, index + 1);
+}
+
+//-------------------------------------------------------------------
+//	Blend between the stored and current transforms, alpha in [0,1]
+//-------------------------------------------------------------------
+
+void CGameObject::getInterpTransform(double alpha, dReal pos[3], dMatrix3 R)
+{
+	Objects().getInterpTransform(getIndex(), alpha, pos, R);
+}
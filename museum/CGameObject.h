@@ -7,17 +7,30 @@
 #define CGAME_OBJECT_H
 
 #include "ODEManager.h"
+#include "CObjectState.h"
 //#include "TextureManager.h"
-#include "ode\ode.h"
+#include <ode/ode.h>
 
 #include <string>
 
+// index into the object manager's slot table in the low bits, the
+// slot's generation in the high bits; stale handles don't resolve
+typedef unsigned int ObjectHandle;
+#define HANDLE_INDEX_BITS	20
+#define HANDLE_INDEX_MASK	((1 << HANDLE_INDEX_BITS) - 1)
+#define INVALID_HANDLE		(0)
+
+class CMarbleSim;
+class CObjectManager;
+
 class CGameObject
 {
+	friend class CObjectManager;	// hands out the handle
 
 public:
 	
-	CGameObject();
+	// the object's body is made in, and it belongs to, this world
+	CGameObject(CMarbleSim& world);
 	virtual ~CGameObject();
 
 	int			ID;					//unique ID for all game objects
@@ -29,9 +42,11 @@ public:
 	virtual void			setVel(double x, double y, double z)=0;
 	virtual const double*	getPos();	
 	virtual dBodyID			getBodyID();
+	dGeomID					getGeomID() { return m_geom; }
+	ObjectHandle			getHandle() { return m_handle; }
 	virtual void			setColor (double r, double g, double b);
 	virtual void			setColor (double r, double g, double b, double a);
-	virtual	const double*	getColor(){ return m_color; };
+	virtual	const double*	getColor();
 	virtual const double*	getSize() { return m_size; };
 	virtual void			DisableGravity();
 	virtual void			EnableGravity();
@@ -42,15 +57,33 @@ public:
 	virtual void			DestroyODEObject();
 	virtual bool			isDynamic();
 
+	// a sleeping body has been still long enough that we've stopped
+	// simulating it; anything that pushes it should wake it first
+	bool					isAsleep();
+	void					Wake();
+
+	// physics state from before the last step, for render interpolation
+	void					StorePhysicsState();
+	void					getInterpTransform(double alpha, dReal pos[3], dMatrix3 R);
+
+	// our entry in the manager's CObjectState; moves as objects sleep,
+	// wake and die, so look it up again rather than keeping it
+	int						getIndex();
+	CObjectState&			State();
+	CMarbleSim&				getWorld() { return m_world; }
+
 protected:
+	CObjectManager&			Objects();
+	ODEManager&				ODE();
+
+	CMarbleSim&	m_world;
 	dBodyID m_body;				// the body
 	dGeomID m_geom;				// geometries representing this body
-	double	m_position[3];		// position in world cordinates
 	double	m_size[3];			// width/depth/height
-	double	m_color[4];			// 4 value color
 	//Texture*  m_texture;
 	bool	m_dynamic;
 	bool	m_odeDestroyed;
+	ObjectHandle m_handle;		// set by the manager, also in the body's user data
 private:
 	static int lastID;
 
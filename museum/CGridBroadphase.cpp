@@ -0,0 +1,178 @@
+#include "CGridBroadphase.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// cell coords are packed 21 bits each, biased so negatives sort first
+#define CELL_BITS	21
+#define CELL_BIAS	(1 << (CELL_BITS-1))
+#define CELL_MASK	((1 << CELL_BITS) - 1)
+
+// the 13 neighbours that sort after a cell; with the cell itself
+// they cover every neighbouring pair exactly once
+static const int s_forwardNeighbours[13][3] = {
+	{ 0, 0, 1},
+	{ 0, 1,-1}, { 0, 1, 0}, { 0, 1, 1},
+	{ 1,-1,-1}, { 1,-1, 0}, { 1,-1, 1},
+	{ 1, 0,-1}, { 1, 0, 0}, { 1, 0, 1},
+	{ 1, 1,-1}, { 1, 1, 0}, { 1, 1, 1}
+};
+
+static CellKey PackCell(int ix, int iy, int iz)
+{
+	return ((CellKey)((ix + CELL_BIAS) & CELL_MASK) << (2*CELL_BITS)) |
+		   ((CellKey)((iy + CELL_BIAS) & CELL_MASK) << CELL_BITS) |
+		    (CellKey)((iz + CELL_BIAS) & CELL_MASK);
+}
+
+static int UnpackCell(CellKey key, int axis)
+{
+	return (int)((key >> ((2-axis)*CELL_BITS)) & CELL_MASK) - CELL_BIAS;
+}
+
+CGridBroadphase::CGridBroadphase(double cellSize)
+{
+	setCellSize(cellSize);
+	m_numPairs = 0;
+}
+
+void CGridBroadphase::setCellSize(double cellSize)
+{
+	assert(cellSize > 0);
+	m_cellSize = cellSize;
+	m_invCellSize = 1.0/cellSize;
+}
+
+CellKey CGridBroadphase::MakeKey(double x, double y, double z)
+{
+	return PackCell((int)floor(x*m_invCellSize),
+					(int)floor(y*m_invCellSize),
+					(int)floor(z*m_invCellSize));
+}
+
+//-------------------------------------------------------------------
+//	Find every candidate pair in the space
+//-------------------------------------------------------------------
+
+void CGridBroadphase::Collide(dSpaceID space, void* data, dNearCallback* callback)
+{
+	m_numPairs = 0;
+	m_sphereGeoms.clear();
+	m_sphereBodies.clear();
+	m_sphereData.clear();
+	m_cells.clear();
+	m_otherGeoms.clear();
+	m_otherAABBs.clear();
+
+	// sort the geoms into grid spheres and everything else
+	int num = dSpaceGetNumGeoms(space);
+	for (int i = 0; i < num; i++) {
+		dGeomID g = dSpaceGetGeom(space, i);
+		if (!dGeomIsEnabled(g)) continue;
+
+		if (dGeomGetClass(g) == dSphereClass &&
+			2*dGeomSphereGetRadius(g) <= m_cellSize)
+		{
+			const dReal* pos = dGeomGetPosition(g);
+			CellEntry e;
+			e.key = MakeKey(pos[0], pos[1], pos[2]);
+			e.sphere = m_sphereGeoms.size();
+			m_cells.push_back(e);
+			m_sphereGeoms.push_back(g);
+			m_sphereBodies.push_back(dGeomGetBody(g));
+			m_sphereData.push_back(pos[0]);
+			m_sphereData.push_back(pos[1]);
+			m_sphereData.push_back(pos[2]);
+			m_sphereData.push_back(dGeomSphereGetRadius(g));
+		} else {
+			dReal aabb[6];
+			dGeomGetAABB(g, aabb);
+			m_otherGeoms.push_back(g);
+			for (int j = 0; j < 6; j++) m_otherAABBs.push_back(aabb[j]);
+		}
+	}
+
+	std::sort(m_cells.begin(), m_cells.end());
+
+	// sphere vs sphere through the grid, one run of equal keys at a time
+	int numCells = m_cells.size();
+	int runStart = 0;
+	while (runStart < numCells) {
+		CellKey key = m_cells[runStart].key;
+		int runEnd = runStart + 1;
+		while (runEnd < numCells && m_cells[runEnd].key == key) runEnd++;
+
+		for (int a = runStart; a < runEnd; a++)
+			for (int b = a + 1; b < runEnd; b++)
+				TestSpheres(m_cells[a].sphere, m_cells[b].sphere, data, callback);
+
+		int ix = UnpackCell(key, 0);
+		int iy = UnpackCell(key, 1);
+		int iz = UnpackCell(key, 2);
+		for (int n = 0; n < 13; n++) {
+			CellEntry probe;
+			probe.key = PackCell(ix + s_forwardNeighbours[n][0],
+								 iy + s_forwardNeighbours[n][1],
+								 iz + s_forwardNeighbours[n][2]);
+			std::vector<CellEntry>::iterator it =
+				std::lower_bound(m_cells.begin() + runEnd, m_cells.end(), probe);
+			for (; it != m_cells.end() && it->key == probe.key; ++it)
+				for (int a = runStart; a < runEnd; a++)
+					TestSpheres(m_cells[a].sphere, it->sphere, data, callback);
+		}
+		runStart = runEnd;
+	}
+
+	// the odd geoms against each other and against every sphere
+	int numOthers = m_otherGeoms.size();
+	for (int i = 0; i < numOthers; i++) {
+		const dReal* aabb = &m_otherAABBs[i*6];
+		for (int j = i + 1; j < numOthers; j++)
+			TestBounds(m_otherGeoms[i], aabb, m_otherGeoms[j], &m_otherAABBs[j*6], data, callback);
+
+		int numSpheres = m_sphereGeoms.size();
+		for (int s = 0; s < numSpheres; s++) {
+			const dReal* p = &m_sphereData[s*4];
+			dReal sphereAABB[6] = { p[0]-p[3], p[0]+p[3],
+									p[1]-p[3], p[1]+p[3],
+									p[2]-p[3], p[2]+p[3] };
+			TestBounds(m_otherGeoms[i], aabb, m_sphereGeoms[s], sphereAABB, data, callback);
+		}
+	}
+}
+
+//-------------------------------------------------------------------
+//	Two grid spheres - exact overlap test is cheaper than the callback
+//-------------------------------------------------------------------
+
+void CGridBroadphase::TestSpheres(int a, int b, void* data, dNearCallback* callback)
+{
+	// geoms on the same body never collide, same as the ODE spaces
+	if (m_sphereBodies[a] && m_sphereBodies[a] == m_sphereBodies[b]) return;
+
+	const dReal* pa = &m_sphereData[a*4];
+	const dReal* pb = &m_sphereData[b*4];
+	dReal dx = pa[0] - pb[0];
+	dReal dy = pa[1] - pb[1];
+	dReal dz = pa[2] - pb[2];
+	dReal r = pa[3] + pb[3];
+	if (dx*dx + dy*dy + dz*dz > r*r) return;
+
+	m_numPairs++;
+	callback(data, m_sphereGeoms[a], m_sphereGeoms[b]);
+}
+
+void CGridBroadphase::TestBounds(dGeomID g1, const dReal* aabb1, dGeomID g2, const dReal* aabb2,
+								 void* data, dNearCallback* callback)
+{
+	dBodyID b1 = dGeomGetBody(g1);
+	if (b1 && b1 == dGeomGetBody(g2)) return;
+
+	for (int axis = 0; axis < 3; axis++)
+		if (aabb1[axis*2] > aabb2[axis*2+1] || aabb2[axis*2] > aabb1[axis*2+1])
+			return;
+
+	m_numPairs++;
+	callback(data, g1, g2);
+}
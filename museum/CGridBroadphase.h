@@ -0,0 +1,72 @@
+//-------------------------------------------------------------------
+//	CGridBroadphase
+//
+//	Flat uniform grid for lots of spheres the same size.  Every sphere
+//	goes in the one cell holding its centre; with cells at least a
+//	diameter wide, a sphere can only touch spheres in its own cell or
+//	the 26 around it.  Cells live in a sorted array of (cell, sphere)
+//	pairs, so there's no hashing and the memory is walked in order.
+//
+//	Anything that isn't a small enough sphere (the plane, boxes,
+//	transforms) is checked by bounding box against everything else.
+//-------------------------------------------------------------------
+#ifndef CGRID_BROADPHASE_H
+#define CGRID_BROADPHASE_H
+
+#include <ode/ode.h>
+#include <vector>
+
+#ifdef _MSC_VER
+typedef unsigned __int64 CellKey;
+#else
+typedef unsigned long long CellKey;
+#endif
+
+class CGridBroadphase
+{
+public:
+	CGridBroadphase(double cellSize);
+
+	void	setCellSize(double cellSize);
+	double	getCellSize() { return m_cellSize; }
+
+	// same contract as dSpaceCollide: callback gets every pair of
+	// geoms in space whose bounds might overlap, each pair once
+	void	Collide(dSpaceID space, void* data, dNearCallback* callback);
+
+	int		getNumPairs() { return m_numPairs; }
+	// the buffers' capacity added up, which only goes up when they grow
+	size_t	getCapacity() {
+		return m_sphereGeoms.capacity() + m_sphereBodies.capacity() + m_sphereData.capacity() +
+			m_cells.capacity() + m_otherGeoms.capacity() + m_otherAABBs.capacity();
+	}
+
+private:
+	struct CellEntry
+	{
+		CellKey	key;
+		int		sphere;
+		bool operator< (const CellEntry& rhs) const { return key < rhs.key; }
+	};
+
+	CellKey	MakeKey(double x, double y, double z);
+	void	TestSpheres(int a, int b, void* data, dNearCallback* callback);
+	void	TestBounds(dGeomID g1, const dReal* aabb1, dGeomID g2, const dReal* aabb2,
+					   void* data, dNearCallback* callback);
+
+	double	m_cellSize;
+	double	m_invCellSize;
+	int		m_numPairs;
+
+	// spheres that fit the grid, in space order
+	std::vector<dGeomID>	m_sphereGeoms;
+	std::vector<dBodyID>	m_sphereBodies;
+	std::vector<dReal>		m_sphereData;	// x, y, z, radius per sphere
+	std::vector<CellEntry>	m_cells;		// sorted by cell
+
+	// everything else, with its bounding box
+	std::vector<dGeomID>	m_otherGeoms;
+	std::vector<dReal>		m_otherAABBs;	// 6 per geom, ODE order
+};
+
+#endif
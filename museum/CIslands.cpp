@@ -0,0 +1,66 @@
+#include "CIslands.h"
+#include "CObjectManager.h"
+
+CIslands::CIslands()
+{
+	m_numIslands = 0;
+	m_largest = 0;
+}
+
+int CIslands::Find(int i)
+{
+	while (m_parent[i] != i) {
+		m_parent[i] = m_parent[m_parent[i]];	// path halving
+		i = m_parent[i];
+	}
+	return i;
+}
+
+// the lower root wins, which is what keeps the numbering stable
+void CIslands::Union(int a, int b)
+{
+	a = Find(a);
+	b = Find(b);
+	if (a < b) m_parent[b] = a;
+	else if (b < a) m_parent[a] = b;
+}
+
+void CIslands::Build(CContactArena& contacts, CObjectManager& om)
+{
+	int numActive = om.getNumActive();
+	int i;
+
+	m_parent.resize(numActive);
+	m_island.resize(numActive);
+	m_size.resize(numActive);
+	for (i = 0; i < numActive; i++)
+		m_parent[i] = i;
+
+	// contacts with the floor or a sleeper have a 0 body and don't join
+	int num = contacts.getNumContacts();
+	for (i = 0; i < num; i++) {
+		dBodyID b1 = contacts.getBody1(i);
+		dBodyID b2 = contacts.getBody2(i);
+		if (!b1 || !b2) continue;
+		int i1 = om.getIndex((ObjectHandle)(size_t)dBodyGetData(b1));
+		int i2 = om.getIndex((ObjectHandle)(size_t)dBodyGetData(b2));
+		if (i1 >= 0 && i1 < numActive && i2 >= 0 && i2 < numActive)
+			Union(i1, i2);
+	}
+
+	// a root is always the lowest index in its island, so the roots
+	// come up in the order we want to number them
+	m_numIslands = 0;
+	m_largest = 0;
+	for (i = 0; i < numActive; i++) {
+		int root = Find(i);
+		if (root == i) {
+			m_island[i] = m_numIslands;
+			m_size[m_numIslands++] = 0;
+		} else {
+			m_island[i] = m_island[root];
+		}
+		if (++m_size[m_island[i]] > m_largest)
+			m_largest = m_size[m_island[i]];
+	}
+}
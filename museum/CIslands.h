@@ -0,0 +1,44 @@
+//-------------------------------------------------------------------
+//	CIslands
+//
+//	Splits the awake objects into islands: groups joined by this
+//	step's contacts, which can be solved without looking at each
+//	other.  Islands are numbered in order of their lowest object
+//	index, so the numbering doesn't depend on the order contacts
+//	were found in.
+//-------------------------------------------------------------------
+#ifndef CISLANDS_H
+#define CISLANDS_H
+
+#include "CContactArena.h"
+
+class CObjectManager;
+
+#include <vector>
+
+class CIslands
+{
+public:
+	CIslands();
+
+	// the object manager's awake objects
+	void	Build(CContactArena& contacts, CObjectManager& om);
+
+	int		getNumIslands() { return m_numIslands; }
+	int		getLargest() { return m_largest; }		// objects in the biggest one
+	int		getIsland(int index) { return m_island[index]; }
+	// the buffers' capacity added up, which only goes up when they grow
+	size_t	getCapacity() { return m_parent.capacity() + m_island.capacity() + m_size.capacity(); }
+
+private:
+	int		Find(int i);
+	void	Union(int a, int b);
+
+	std::vector<int>	m_parent;
+	std::vector<int>	m_island;
+	std::vector<int>	m_size;
+	int		m_numIslands;
+	int		m_largest;
+};
+
+#endif
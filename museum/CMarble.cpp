@@ -1,100 +1,128 @@
 #include "CMarble.h"
 #include "CGameObject.h"
+#ifndef MARBLES_HEADLESS
 #include "CGLRender.h"
+#include <gl/glut.h>
+#endif
+
+#include "CObjectManager.h"
+#include "CMarbleSim.h"
 
 #include <ode/ode.h>
-#include <gl/glut.h>
 #include <stdlib.h>
 
-CMarble::CMarble()
+CMarble::CMarble(CMarbleSim& world) : CGameObject(world)
 {	 
-	m_radius=MARBLE_RADIUS;
-	dMass m; 
-	m_texture = -1;
-	bool inPlay = true;
-
+	Create(MARBLE_RADIUS, MAT_Clearie);
+	setColor(0.8f,0.8f,0.8f,1.0f);
+}
 
-	//Create sphere	
-	dMassSetSphere (&m,20.0f,m_radius/2);	
-	m_geom = ODEManager::Instance().createSphere(m_radius);
+// a tolley is just a bigger marble; it goes through Create like any
+// other so the body only ever has the one geom
+CMarble::CMarble(CMarbleSim& world, double radius, SurfaceMaterial material) : CGameObject(world)
+{
+	Create(radius, material);
+}
 
-	dGeomSetBody (m_geom,m_body);
-    dBodySetMass (m_body,&m);	
-	
-	//m_numberTexture = 0;
-	setPos(0.0f,0.0f,0.0f);	
-	setColor(0.8f,0.8f,0.8f,1.0f);
+CTolley::CTolley(CMarbleSim& world) : CMarble(world, TOLLEY_RADIUS, MAT_Tolley)
+{
+	setColor(1.0f,1.0f,1.0f,1.0f);
 }
 
-CTolley::CTolley()
+void
+CMarble::Create(double radius, SurfaceMaterial material)
 {
-	m_radius=TOLLEY_RADIUS;
-	dMass m;	
-		
+	State().radius[getIndex()] = radius;
+	dMass m; 
+
+
 	//Create sphere	
-	dMassSetSphere (&m,20.0f,m_radius/2);	
-	m_geom = ODEManager::Instance().createSphere(m_radius);
+	dMassSetSphere (&m,20.0f,radius/2);	
+	m_geom = ODE().createSphere(radius);
 
 	dGeomSetBody (m_geom,m_body);
     dBodySetMass (m_body,&m);	
+	setMaterial(material);
 	
 	//m_numberTexture = 0;
 	setPos(0.0f,0.0f,0.0f);	
-	setColor(1.0f,1.0f,1.0f,1.0f);
 }
 
 CMarble::~CMarble()
 {
-	free(m_geom);
+	// the geom belongs to ODE, never free() it
+	DestroyODEObject();
 }
 
 double 
 CMarble::getRadius()
 {
-	return m_radius;
+	return State().radius[getIndex()];
 }
 
 void 
 CMarble::setRadius(double r) 
 {
-	m_radius = r;
+	State().radius[getIndex()] = r;
 	dMass m;	
-	dMassSetSphere (&m,10.0f,m_radius);
+	dMassSetSphere (&m,10.0f,r);
     dBodySetMass (m_body,&m);
 }
-/*@todo
-  add a new class for the tolley, or be able to alter the 
-  dAccel value for tolley...
-*/
+
+bool
+CMarble::isInPlay()
+{
+	return State().inPlay[getIndex()] != 0;
+}
+
+SurfaceMaterial
+CMarble::getMaterial()
+{
+	return (SurfaceMaterial)State().material[getIndex()];
+}
+
+// the geom's copy is what the contacts go by
+void
+CMarble::setMaterial(SurfaceMaterial material)
+{
+	State().material[getIndex()] = material;
+	ODEManager::setGeomMaterial(m_geom, material);
+}
+
 void
 CMarble::Update ()
 {
-	dReal dAccel = -1.0;
-	dReal dAngAccel = -0.05;
-	float dist = (m_lastPosition[0])*(m_lastPosition[0]) +
-				 (m_lastPosition[2])*(m_lastPosition[2]);
-	
-	if (  dist > RING_RADIUS*RING_RADIUS ) {
-		 dAccel = -3.0;
-		 dAngAccel = -0.1;
-		 m_inPlay = false;
-		 m_color[1] = m_color[2] = 0;
+	int i = getIndex();
+	Objects().GatherState(i, i + 1);
+	UpdateAll(State(), i, i + 1, ODE().getEvents());
+}
+
+void
+CTolley::Update ()
+{
+	CMarble::Update();
+}
+
+//-------------------------------------------------------------------
+//	Take the marbles in [begin, end) that have left the ring out of
+//	play.  Called once per physics step, after GatherState has copied
+//	positions and velocities in.  Rolling them to a stop is up to the
+//	contact surfaces now, see ODEManager::InitSurfaces.
+//-------------------------------------------------------------------
+void
+CMarble::UpdateAll(CObjectState& s, int begin, int end, CCollisionEvents& events)
+{
+	for (int i = begin; i < end; i++) {
+		if (s.material[i] == MAT_Tolley || !s.inPlay[i])
+			continue;
+		if (s.posX[i]*s.posX[i] + s.posZ[i]*s.posZ[i] <= RING_RADIUS*RING_RADIUS)
+			continue;
+		s.inPlay[i] = 0;
+		s.color[i*4+1] = s.color[i*4+2] = 0;
+		events.RingOut(s.body[i], s.velX[i]*s.velX[i] + s.velY[i]*s.velY[i] + s.velZ[i]*s.velZ[i]);
 	}
-	
-	m_lastPosition[0] = m_position[0];
-	m_lastPosition[1] = m_position[1];
-	m_lastPosition[2] = m_position[2];
-	const dReal* pos = dBodyGetPosition(m_body);
-	m_position[0] = pos[0];
-	m_position[1] = pos[1];
-	m_position[2] = pos[2];
-	const dReal* vel = dBodyGetLinearVel(m_body);
-	const dReal* omega   = dBodyGetAngularVel (m_body);
-	if (m_position[1] <= m_radius) 
-		dBodyAddTorque(m_body, dAngAccel*omega[0], dAngAccel*omega[1], dAngAccel*omega[2]);
-	if (m_position[1] <= m_radius) 
-		;//dBodyAddForce(m_body, vel[0]*dAccel, 0, vel[2]*dAccel);
 }
+
 double
 CMarble::getVel()
 {
@@ -105,75 +133,66 @@ CMarble::getVel()
 	return val;
 }
 
-// the tolley needs to slow down regardless of whether it's in the circle 
-void
-CTolley::Update ()
+void 
+CMarble::Draw ()
 {
-	dReal dAccel = -1.5;
-	dReal dAngAccel = -0.5;
-	float dist = (m_lastPosition[0])*(m_lastPosition[0]) +
-				 (m_lastPosition[2])*(m_lastPosition[2]);
-	
-	if (  dist > RING_RADIUS*RING_RADIUS ) {
-		 dAccel = -3.0;
-		 dAngAccel = -0.3;
-	}
-	
-	m_lastPosition[0] = m_position[0];
-	m_lastPosition[1] = m_position[1];
-	m_lastPosition[2] = m_position[2];
-	const dReal* pos = dBodyGetPosition(m_body);
-	m_position[0] = pos[0];
-	m_position[1] = pos[1];
-	m_position[2] = pos[2];
-	const dReal* vel = dBodyGetLinearVel(m_body);
-	const dReal* omega   = dBodyGetAngularVel (m_body);
-	if (m_position[1] <= m_radius) 
-		dBodyAddTorque(m_body, dAngAccel*omega[0], dAngAccel*omega[1], dAngAccel*omega[2]);
-	if (m_position[1] <= m_radius) 
-		dBodyAddForce(m_body, vel[0]*dAccel, 0, vel[2]*dAccel);
+	int i = getIndex();
+	DrawAll(Objects(), i, i + 1, ODE().getInterpAlpha());
 }
 
-void 
-CMarble::Draw ()
+void
+CMarble::DrawAll(CObjectManager& om, int begin, int end, double alpha)
 {
-	CGLRender::Instance().setTexture(m_texture);
-	CGLRender::Instance().setColorLight(m_color[0], m_color[1], m_color[2], m_color[3], 0.4);
-	const dReal* pos = dGeomGetPosition(m_geom);  
-	const dReal* R   = dGeomGetRotation(m_geom);
-	CGLRender::Instance().drawSphere(pos, R, m_radius);
+#ifndef MARBLES_HEADLESS
+	CObjectState& s = om.getState();
+	for (int i = begin; i < end; i++) {
+		const double* color = &s.color[i*4];
+		CGLRender::Instance().setTexture(s.texture[i]);
+		CGLRender::Instance().setColorLight(color[0], color[1], color[2], color[3], 0.4);
+		dReal pos[3];
+		dMatrix3 R;
+		om.getInterpTransform(i, alpha, pos, R);
+		CGLRender::Instance().drawSphere(pos, R, s.radius[i]);
+	}
+#endif
 }
 
 void 
 CMarble::AddForce(double x, double y, double z)
 {
-	if(!m_odeDestroyed)
+	if(!m_odeDestroyed) {
+		Wake();
 		dBodyAddForce(m_body, x, y, z);	
+	}
 }
 void 
 CMarble::AddTorque(double x, double y, double z)
 {
-	if(!m_odeDestroyed)
+	if(!m_odeDestroyed) {
+		Wake();
 		dBodyAddTorque(m_body, x, y, z);
+	}
 }
 
 void 
 CMarble::setVel(double x, double y, double z)
 {
+	Wake();
 	dBodySetLinearVel(m_body,x,y,z);
 }
 
 void 
 CMarble::setPos(double x, double y, double z)
 {
-	m_position[0] = x;
-	m_position[1] = y;
-	m_position[2] = z;
-
-	m_lastPosition[0] = x;
-	m_lastPosition[1] = y;
-	m_lastPosition[2] = z;
-
-	if(!m_odeDestroyed)
-		dBodySetPosition(m_body, x,y,z);	
+	CObjectState& s = State();
+	int i = getIndex();
+	s.posX[i] = s.lastX[i] = x;
+	s.posY[i] = s.lastY[i] = y;
+	s.posZ[i] = s.lastZ[i] = z;
+
+	if(!m_odeDestroyed) {
+		dBodySetPosition(m_body, x,y,z);
+		// teleported, so don't blend from where we were
+		StorePhysicsState();
+	}
 }
@@ -2,19 +2,27 @@
 #define CMARBLE_H
 
 #include "CGameObject.h"
+#include "CObjectState.h"
 
+#ifndef MARBLES_HEADLESS
 #include <windows.h>
 #include <gl\gl.h>
 #include <gl\glu.h>
+#else
+typedef unsigned int GLuint;
+#endif
 
 #define MARBLE_RADIUS (0.5)
 #define TOLLEY_RADIUS (0.75)
 #define RING_RADIUS (20.0)
 
+class CCollisionEvents;
+class CObjectManager;
+
 class CMarble : public CGameObject
 {
 public:
-	CMarble();
+	CMarble(CMarbleSim& world);
 	~CMarble();
 
 	virtual void Update();
@@ -26,13 +34,24 @@ public:
 	virtual void setPos(double x, double y, double z);
 	double getRadius();
 	void setRadius(double r);
+	bool isInPlay();
+	SurfaceMaterial getMaterial();
+	void setMaterial(SurfaceMaterial material);
+
+	// the passes over a range of CObjectState entries, UpdateAll once
+	// per physics step and DrawAll once per frame; Update and Draw
+	// above are these for a single marble
+	static void UpdateAll(CObjectState& s, int begin, int end, CCollisionEvents& events);
+	static void DrawAll(CObjectManager& om, int begin, int end, double alpha);
+
 protected:
-	GLuint m_texture;
-	double m_radius;
-	double m_lastPosition[3];
+	CMarble(CMarbleSim& world, double radius, SurfaceMaterial material);
+
 private:
-	bool m_inPlay;
-	static m_textureNumber;
+	void Create(double radius, SurfaceMaterial material);
+
+
+	static int m_textureNumber;
 	const char* m_textureNames;
 	
 };
@@ -40,7 +59,7 @@ private:
 class CTolley : public CMarble
 {
 public:
-	CTolley();
+	CTolley(CMarbleSim& world);
 	virtual void Update();
 };
 
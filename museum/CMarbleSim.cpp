@@ -0,0 +1,143 @@
+#include "CMarbleSim.h"
+#include "CObjectManager.h"
+#include "CMarble.h"
+
+#include <cmath>
+
+// the managers only keep the reference until we're built
+#ifdef _MSC_VER
+#pragma warning(disable: 4355)	// 'this' used in base member initializer list
+#endif
+CMarbleSim::CMarbleSim() : m_odeManager(*this), m_objectManager(*this)
+{
+	m_listener = 0;
+	m_recorder = 0;
+	AddTolley();
+}
+
+CMarbleSim::~CMarbleSim()
+{
+	m_objectManager.DestroyObjects();
+	m_marbleList.clear();
+}
+
+CTolley*
+CMarbleSim::AddTolley()
+{
+	CTolley* tolley = new CTolley(*this);
+	m_objectManager.AddObject(tolley);
+	m_marbleList.push_back(tolley);
+	m_tolleys.push_back(tolley);
+	return tolley;
+}
+
+//========================================================================================
+//		CreateMarbles(int number) creates number amount of marbles and arranges them in 
+//			a grid at the origin
+//========================================================================================
+bool
+CMarbleSim::CreateMarbles(int number)
+{
+	// only rack the marbles we make here, the tolleys stay where they are
+	int first = m_marbleList.size();
+	for (int i = 0; i < number; i++) {
+		CMarble* marble = (CMarble*)m_objectManager.CreateObject(Marble_Type);
+		if (i % CATSEYE_EVERY == CATSEYE_EVERY - 1) {
+			marble->setMaterial(MAT_CatsEye);
+			marble->setColor(0.4f, 0.7f, 0.9f, 1.0f);
+		}
+		m_marbleList.push_back(marble);
+	}
+	if (number <= 0) return true;
+
+	double x = m_marbleList[first]->getRadius()*2;
+
+	int cols = (int)sqrt((double)number)+1;
+	int z = first;
+	for (int i = 0; i < cols; i++) 
+		for (int j = 0; j < cols; j++) {
+			m_marbleList[z++]->setPos((cols/2-i)*x, x/2, (cols/2-j)*x);
+			if (z >= first + number) return true;
+		}
+
+	return true;
+}
+
+//-------------------------------------------------------------------
+//	Fire the tolley along aim, with forward/side spin from the mouse
+//-------------------------------------------------------------------
+void
+CMarbleSim::ShootMarble(CTolley* tolley, CVector3 forward, CVector3 side, CVector3 aim)
+{
+	if (m_recorder)
+		m_recorder->Shoot(m_odeManager.getStepCount(), tolley, forward, side, aim);
+	double yVel = aim.Magnitude()/30.0;
+	if (yVel > 5.0) yVel = 10.0;
+	tolley->setVel(aim.x*1.3,yVel, aim.z*1.3);
+	if (forward.Magnitude() != 0)
+		tolley->AddTorque(forward.x/10, forward.y/10, forward.z/10);
+	if (side.Magnitude() != 0)
+		tolley->AddTorque(side.x/3, side.y/3, side.z/3);
+}
+
+//-------------------------------------------------------------------
+//	The aiming controls set the tolley's position every frame; only
+//	real moves are worth doing, or recording
+//-------------------------------------------------------------------
+void
+CMarbleSim::PlaceTolley(CTolley* tolley, double x, double y, double z)
+{
+	const double* pos = tolley->getPos();
+	if (pos[0] == x && pos[1] == y && pos[2] == z)
+		return;
+	if (m_recorder)
+		m_recorder->PlaceTolley(m_odeManager.getStepCount(), tolley, x, y, z);
+	tolley->setPos(x, y, z);
+}
+
+//-------------------------------------------------------------------
+//	Called by ODEManager after every step to empty the event ring
+//-------------------------------------------------------------------
+void 
+CMarbleSim::DispatchEvents()
+{
+	CCollisionEvents& events = m_odeManager.getEvents();
+	CollisionEvent e;
+	while (events.PopEvent(e)) {
+		if (!m_listener)
+			continue;
+
+		if (e.type == CE_RingOut) {
+			CMarble* obj = (CMarble*)m_objectManager.getObject(e.b1);
+			if (obj)
+				m_listener->OnRingOut(obj);
+			continue;
+		}
+
+		if (e.type != CE_Begin || e.speed <= IMPACT_SPEED)
+			continue;
+
+		CMarble* obj1 = (CMarble*)m_objectManager.getObject(e.b1);
+		CMarble* obj2 = (CMarble*)m_objectManager.getObject(e.b2);
+		if (obj1 && obj2)
+			m_listener->OnImpact(obj1, obj2, e.speed);
+	}
+}
+
+void
+CMarbleSim::Update(double deltaT, bool pause)
+{
+	m_odeManager.SimLoop(deltaT, pause);
+}
+
+void
+CMarbleSim::Advance(int steps)
+{
+	m_odeManager.Advance(steps);
+}
+
+bool
+CMarbleSim::DynamicsDone()
+{
+	return m_objectManager.DynamicsDone();
+}
@@ -0,0 +1,83 @@
+//-------------------------------------------------------------------
+//	CMarbleSim
+//
+//	The simulation core: the ODE world, the objects in it and the
+//	rules of the game.  No window, no GL, no sound, so it can run
+//	headless as fast as the CPU allows.
+//
+//	Each one is a world of its own, with its own ODE world, spaces,
+//	contact group, objects and events, and it's handed to whatever
+//	needs it rather than found through a singleton.  Any number can
+//	exist at once, each stepped on one thread at a time; a thread
+//	other than the one that called dInitODE must call
+//	ODEManager::AttachThread before it makes or steps one.
+//-------------------------------------------------------------------
+#ifndef CMARBLE_SIM_H
+#define CMARBLE_SIM_H
+
+#include "ODEManager.h"
+#include "CObjectManager.h"
+#include "CMarble.h"
+#include "CVector3.h"
+#include "CReplay.h"
+
+#include <vector>
+
+#define IMPACT_SPEED (0.3)	// slower collisions than this aren't impacts (squared speed)
+#define CATSEYE_EVERY (4)	// one marble in this many racked is a cat's eye
+
+// Whoever wants to hear about marbles hitting each other (sound, scoring)
+class CCollisionListener
+{
+public:
+	virtual ~CCollisionListener() {}
+	virtual void OnImpact(CMarble* m1, CMarble* m2, double speed) = 0;
+	virtual void OnRingOut(CMarble* m) {}
+};
+
+class CMarbleSim
+{
+public:
+	CMarbleSim();
+	~CMarbleSim();
+
+	bool	CreateMarbles (int number);
+	// a tolley for another player (the first comes with the world), at
+	// the origin till it's placed.  Worlds that share snapshots or
+	// replays have to add the same ones before racking.
+	CTolley* AddTolley();
+	void	ShootMarble(CTolley* tolley, CVector3 forward, CVector3 side, CVector3 aim);
+	// a player moving the tolley into place (not a teleport by the sim)
+	void	PlaceTolley(CTolley* tolley, double x, double y, double z);
+	// hands this step's collision and ring-out events to the listener
+	void	DispatchEvents();
+
+	// real time: catches up on deltaT seconds of frame time
+	void	Update(double deltaT, bool pause);
+	// headless: exactly this many fixed steps
+	void	Advance(int steps);
+	bool	DynamicsDone();
+
+	ODEManager&		getODEManager() { return m_odeManager; }
+	CObjectManager&	getObjectManager() { return m_objectManager; }
+	CTolley*	getTolley(int i = 0) { return m_tolleys[i]; }
+	int			getNumTolleys() { return m_tolleys.size(); }
+	std::vector<CMarble*>& getMarbles() { return m_marbleList; }
+
+	void	setCollisionListener(CCollisionListener* listener) { m_listener = listener; }
+	// player actions get written here from now on (0 to stop)
+	void	setRecorder(CReplayRecorder* recorder) { m_recorder = recorder; }
+
+private:
+	// ODE has to come up before any object can make a body
+	ODEManager		m_odeManager;
+	CObjectManager	m_objectManager;
+
+	std::vector<CMarble*> m_marbleList;
+	std::vector<CTolley*> m_tolleys;	// a player each
+
+	CCollisionListener* m_listener;
+	CReplayRecorder*	m_recorder;
+};
+
+#endif
@@ -1,25 +1,47 @@
 #include "CObjectManager.h"
+#include "CMarbleSim.h"
 #include "CGameObject.h"
 #include "CMarble.h"
 #include "ObjectFactory.h"
 #include "CTimer.h"
 
 #include <cassert>
+#include <cmath>
+#ifndef MARBLES_HEADLESS
 #include <windows.h>
+#else
+#include <stdio.h>
+#endif
 
 #define DYNAMICS_WAIT (1.0)
 
-CObjectManager::CObjectManager()
+// squared speeds: under SLEEP counts as still, over WAKE is really
+// moving, and in between the still timer just holds (hysteresis)
+#define SLEEP_LINEAR_SQ		(0.1*0.1)
+#define SLEEP_ANGULAR_SQ	(0.2*0.2)
+#define WAKE_LINEAR_SQ		(0.2*0.2)
+#define WAKE_ANGULAR_SQ		(0.4*0.4)
+
+static void ReportError(const char* text)
+{
+#ifndef MARBLES_HEADLESS
+	MessageBox(NULL,text,"ERROR",MB_OK|MB_ICONEXCLAMATION);
+#else
+	fprintf(stderr, "ERROR: %s\n", text);
+#endif
+}
+
+CObjectManager::CObjectManager(CMarbleSim& sim) : m_sim(sim)
 {
 	m_objectList.clear();
 	if (!CGameObjectFactory.Register<CMarble>(Marble_Type)) {
-		MessageBox(NULL,"Failed To Register The Object Class in ObjectFactory","ERROR",MB_OK|MB_ICONEXCLAMATION);
+		ReportError("Failed To Register The Object Class in ObjectFactory");
 	}
 	if (!CGameObjectFactory.Register<CTolley>(Tolley_Type)) {
-		MessageBox(NULL,"Failed To Register The Object Class in ObjectFactory","ERROR",MB_OK|MB_ICONEXCLAMATION);
+		ReportError("Failed To Register The Object Class in ObjectFactory");
 	}
-	CObjectManager::m_dynamicWaitLastTime = 0;
-	CObjectManager::m_dynamicWaitTime = 0;
+	m_dynamicWaitTime = DYNAMICS_WAIT;
+	m_numActive = 0;
 }
 
 CObjectManager::~CObjectManager()
@@ -34,32 +56,106 @@ CObjectManager::~CObjectManager()
 void
 CObjectManager::AddObject(CGameObject* in)
 {
-	m_objectList.push_back(in);
-	m_objectIDMap[in->getBodyID()] = in;
+	// objects register themselves when they're constructed
+	if (getObject(in->getHandle()) != in)
+		Register(in);
 }
 
 CGameObject* CObjectManager::CreateObject  (std::string type)
 {
 	CGameObject* obj;
-	if (( obj = CGameObjectFactory.Create(type)) == 0)
+	if (( obj = CGameObjectFactory.Create(type, m_sim)) == 0)
 		throw "CGameObjectFactory.Create returned 0";
 	
-	m_objectIDMap[obj->getBodyID()] = obj;
-	m_objectList.push_back(obj);
 	return obj;
 }
 
+//-------------------------------------------------------------------
+//	Give an object a handle and a place in the dense list
+//-------------------------------------------------------------------
+void
+CObjectManager::Register(CGameObject* obj)
+{
+	int slot;
+	if (!m_freeSlots.empty()) {
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	} else {
+		slot = m_slots.size();
+		assert(slot <= HANDLE_INDEX_MASK);
+		HandleSlot s;
+		s.generation = 1;
+		m_slots.push_back(s);
+	}
+
+	int dense = m_objectList.size();
+	m_slots[slot].dense = dense;
+	m_objectList.push_back(obj);
+	m_denseSlots.push_back(slot);
+	m_state.Push(obj->getBodyID());
+
+	obj->m_handle = (m_slots[slot].generation << HANDLE_INDEX_BITS) | slot;
+	dBodySetData(obj->getBodyID(), (void*)(size_t)obj->m_handle);
+	Activate(dense);
+}
+
+//-------------------------------------------------------------------
+//	Swap two entries of the dense list, keeping the handles right
+//-------------------------------------------------------------------
+void
+CObjectManager::Swap(int a, int b)
+{
+	if (a == b) return;
+	CGameObject* obj = m_objectList[a];
+	m_objectList[a] = m_objectList[b];
+	m_objectList[b] = obj;
+	int slot = m_denseSlots[a];
+	m_denseSlots[a] = m_denseSlots[b];
+	m_denseSlots[b] = slot;
+	m_slots[m_denseSlots[a]].dense = a;
+	m_slots[m_denseSlots[b]].dense = b;
+	m_state.Swap(a, b);
+}
+
+//-------------------------------------------------------------------
+//	Destroy one object; the last one moves into its place
+//-------------------------------------------------------------------
+void
+CObjectManager::DestroyObject(CGameObject* obj)
+{
+	int dense = getIndex(obj->getHandle());
+	if (dense < 0 || m_objectList[dense] != obj) return;
+
+	Deactivate(dense);
+	dense = getIndex(obj->getHandle());
+	int last = m_objectList.size() - 1;
+	Swap(dense, last);
+
+	int slot = m_denseSlots[last];
+	m_objectList.pop_back();
+	m_denseSlots.pop_back();
+	m_state.Pop();
+
+	// bump the generation so old handles to this slot stop resolving,
+	// never landing on 0 so INVALID_HANDLE stays invalid
+	HandleSlot& s = m_slots[slot];
+	s.dense = -1;
+	s.generation = (s.generation + 1) & (0xffffffffu >> HANDLE_INDEX_BITS);
+	if (s.generation == 0) s.generation = 1;
+	m_freeSlots.push_back(slot);
+
+	obj->m_handle = INVALID_HANDLE;
+	obj->DestroyODEObject();
+	delete obj;
+}
+
 //-------------------------------------------------------------------
 //	Draw all objects
 //-------------------------------------------------------------------
 
 void CObjectManager::DrawObjects()
 {
-	ObjectList::iterator i;
-	for(i = m_objectList.begin(); i != m_objectList.end(); i++)
-	{
-		(*i)->Draw();
-	}
+	CMarble::DrawAll(*this, 0, m_state.size(), m_sim.getODEManager().getInterpAlpha());
 }
 
 
@@ -69,15 +165,8 @@ void CObjectManager::DrawObjects()
 
 void CObjectManager::DestroyObjects()
 {
-	int size = m_objectList.size();
-	for(int i = 0; i < size; i++)
-	{
-		CGameObject* curr = m_objectList[i];
-		curr->DestroyODEObject();
-		delete curr;
-	}
-	
-	m_objectList.clear();
+	while (!m_objectList.empty())
+		DestroyObject(m_objectList.back());
 }
 
 //-------------------------------------------------------------------
@@ -86,21 +175,208 @@ void CObjectManager::DestroyObjects()
 
 void CObjectManager::UpdateObjects()
 {
-	ObjectList::iterator i=0;
-	for(i = m_objectList.begin(); i != m_objectList.end(); i++)
-	{
-		(*i)->Update();
-	}	
+	// sleeping objects haven't moved, so there's nothing to update
+	GatherState(0, m_numActive);
+	CMarble::UpdateAll(m_state, 0, m_numActive, m_sim.getODEManager().getEvents());
 }
 
+void CObjectManager::GatherState(int begin, int end)
+{
+	CObjectState& s = m_state;
+	for (int i = begin; i < end; i++) {
+		dBodyID b = s.body[i];
+		const dReal* pos = dBodyGetPosition(b);
+		const dReal* vel = dBodyGetLinearVel(b);
+		const dReal* ang = dBodyGetAngularVel(b);
+		s.lastX[i] = s.posX[i]; s.lastY[i] = s.posY[i]; s.lastZ[i] = s.posZ[i];
+		s.posX[i] = pos[0]; s.posY[i] = pos[1]; s.posZ[i] = pos[2];
+		s.velX[i] = vel[0]; s.velY[i] = vel[1]; s.velZ[i] = vel[2];
+		s.angX[i] = ang[0]; s.angY[i] = ang[1]; s.angZ[i] = ang[2];
+	}
+}
+
+
+//-------------------------------------------------------------------
+//	Snapshot every body before a physics step (for interpolation)
+//-------------------------------------------------------------------
+
+void CObjectManager::StorePhysicsState()
+{
+	StorePhysicsState(0, m_numActive);
+}
+
+void CObjectManager::StorePhysicsState(int begin, int end)
+{
+	CObjectState& s = m_state;
+	for (int i = begin; i < end; i++) {
+		const dReal* pos = dBodyGetPosition(s.body[i]);
+		const dReal* q   = dBodyGetQuaternion(s.body[i]);
+		s.prevX[i] = pos[0]; s.prevY[i] = pos[1]; s.prevZ[i] = pos[2];
+		for (int j = 0; j < 4; j++) s.prevRot[i*4+j] = q[j];
+	}
+}
+
+//-------------------------------------------------------------------
+//	Blend between the stored and current transforms, alpha in [0,1]
+//-------------------------------------------------------------------
+
+void CObjectManager::getInterpTransform(int index, double alpha, dReal pos[3], dMatrix3 R)
+{
+	const CObjectState& s = m_state;
+	dBodyID b = s.body[index];
+	const dReal* cur  = dBodyGetPosition(b);
+	const dReal* curQ = dBodyGetQuaternion(b);
+	const dReal* prevQ = &s.prevRot[index*4];
+	pos[0] = s.prevX[index] + (cur[0] - s.prevX[index])*alpha;
+	pos[1] = s.prevY[index] + (cur[1] - s.prevY[index])*alpha;
+	pos[2] = s.prevZ[index] + (cur[2] - s.prevZ[index])*alpha;
+
+	// nlerp is plenty for the tiny rotations of one step; take the
+	// short way round if the quaternions are in opposite hemispheres
+	int i;
+	dReal dot = 0;
+	for (i = 0; i < 4; i++) dot += prevQ[i]*curQ[i];
+	dReal sign = (dot < 0) ? -1 : 1;
+	dQuaternion q;
+	dReal len = 0;
+	for (i = 0; i < 4; i++) {
+		q[i] = prevQ[i] + (sign*curQ[i] - prevQ[i])*alpha;
+		len += q[i]*q[i];
+	}
+	len = sqrt(len);
+	if (len > 0)
+		for (i = 0; i < 4; i++) q[i] /= len;
+	dRfromQ(R, q);
+}
 
 //----------------------------------------------------------
-//	Looks up an object based on its ODE id
+//	Looks up an object based on its ODE id; the body's user
+//	data holds the handle, so this is a couple of array reads
 //----------------------------------------------------------
 CGameObject* 
 CObjectManager::getObject(dBodyID id)
 {
-	return m_objectIDMap[id];
+	if (!id) return 0;
+	return getObject((ObjectHandle)(size_t)dBodyGetData(id));
+}
+
+CGameObject* 
+CObjectManager::getObject(ObjectHandle handle)
+{
+	int index = getIndex(handle);
+	return (index < 0) ? 0 : m_objectList[index];
+}
+
+int
+CObjectManager::getIndex(ObjectHandle handle)
+{
+	unsigned int slot = handle & HANDLE_INDEX_MASK;
+	if (handle == INVALID_HANDLE || slot >= m_slots.size()) return -1;
+	const HandleSlot& s = m_slots[slot];
+	if (s.dense < 0 || s.generation != (handle >> HANDLE_INDEX_BITS)) return -1;
+	return s.dense;
+}
+
+//----------------------------------------------------------
+//	Sleeping
+//
+//	Once a body has been still for m_dynamicWaitTime it's disabled
+//	and moved out of the awake range, so ODE leaves it out of the
+//	step and we leave it out of collision and updates.  It wakes when
+//	something pushes it or a moving body runs into it.
+//----------------------------------------------------------
+
+void CObjectManager::Activate(int index)
+{
+	if (index < m_numActive) return;
+	Swap(index, m_numActive);
+	m_state.stillTime[m_numActive] = 0;
+	m_numActive++;
+}
+
+void CObjectManager::Deactivate(int index)
+{
+	if (index >= m_numActive) return;
+	m_numActive--;
+	Swap(index, m_numActive);
+}
+
+void CObjectManager::SleepObject(CGameObject* obj)
+{
+	int index = getIndex(obj->getHandle());
+	if (index < 0 || index >= m_numActive) return;
+
+	Deactivate(index);
+	dBodyID body = obj->getBodyID();
+	dBodySetLinearVel(body, 0, 0, 0);
+	dBodySetAngularVel(body, 0, 0, 0);
+	dBodyDisable(body);
+	m_sim.getODEManager().setGeomAsleep(obj->getGeomID(), true);
+	// stop Draw blending from where it was a step ago
+	index = getIndex(obj->getHandle());
+	StorePhysicsState(index, index + 1);
+}
+
+void CObjectManager::WakeObject(CGameObject* obj)
+{
+	int index = getIndex(obj->getHandle());
+	if (index < 0 || index < m_numActive || !obj->isDynamic()) return;
+	dBodyEnable(obj->getBodyID());
+	m_sim.getODEManager().setGeomAsleep(obj->getGeomID(), false);
+	Activate(index);
+}
+
+// called once per physics step
+void CObjectManager::UpdateSleep(double stepSize)
+{
+	CObjectState& s = m_state;
+	int i = 0;
+	while (i < m_numActive) {
+		const dReal* vel = dBodyGetLinearVel(s.body[i]);
+		const dReal* rot = dBodyGetAngularVel(s.body[i]);
+		double lin = vel[0]*vel[0] + vel[1]*vel[1] + vel[2]*vel[2];
+		double ang = rot[0]*rot[0] + rot[1]*rot[1] + rot[2]*rot[2];
+
+		if (lin > WAKE_LINEAR_SQ || ang > WAKE_ANGULAR_SQ)
+			s.stillTime[i] = 0;
+		else if (lin < SLEEP_LINEAR_SQ && ang < SLEEP_ANGULAR_SQ)
+			s.stillTime[i] += stepSize;
+
+		if (s.stillTime[i] >= m_dynamicWaitTime)
+			SleepObject(m_objectList[i]);	// swaps another object into slot i
+		else
+			i++;
+	}
+}
+//----------------------------------------------------------
+//	Decide what a contact between b1 and b2 should attach to.
+//	A moving body wakes a sleeper it hits; a slow one just leans
+//	on it as if it were part of the table, otherwise two settling
+//	neighbours would keep waking each other forever.  Sleepers come
+//	back as 0.  Returns false if neither body needs the contact.
+//----------------------------------------------------------
+
+bool CObjectManager::ResolveContactSleep(dBodyID& b1, dBodyID& b2)
+{
+	bool awake1 = b1 && dBodyIsEnabled(b1);
+	bool awake2 = b2 && dBodyIsEnabled(b2);
+	if (!awake1 && !awake2) return false;
+
+	dBodyID sleeper = 0, mover = 0;
+	if (b1 && !awake1) { sleeper = b1; mover = b2; }
+	if (b2 && !awake2) { sleeper = b2; mover = b1; }
+	if (!sleeper) return true;
+
+	const dReal* vel = dBodyGetLinearVel(mover);
+	double lin = vel[0]*vel[0] + vel[1]*vel[1] + vel[2]*vel[2];
+	CGameObject* obj = getObject(sleeper);
+	if (lin > WAKE_LINEAR_SQ && obj && obj->isDynamic()) {
+		WakeObject(obj);
+		return true;
+	}
+
+	if (sleeper == b1) b1 = 0; else b2 = 0;
+	return true;
 }
 
 //----------------------------------------------------------
@@ -109,22 +385,82 @@ CObjectManager::getObject(dBodyID id)
 bool 
 CObjectManager::DynamicsDone()
 {
-	
-	bool retval = true;
-	int size = m_objectList.size();
-	for(int i = 0; i < size; i++) {
-		if (!m_objectList[i]->isDynamic()) continue;
-		dBodyID curr = m_objectList[i]->getBodyID();
-		const dReal* vel = dBodyGetLinearVel(curr);
-		const dReal* tor = dBodyGetAngularVel(curr);
-		if ((vel[0] <= 0.1 && vel[0] >= -0.1 )&&
-			(vel[1] <= 0.1 && vel[1] >= -0.1 )&& 
-			(vel[2] <= 0.1 && vel[2] >= -0.1 ))
-			;
-		else retval = false;
+	return m_numActive == 0;
+}
+
+//----------------------------------------------------------
+//	Snapshots
+//----------------------------------------------------------
+
+void CObjectManager::SaveState(CSnapshot& snapshot)
+{
+	CObjectState& s = m_state;
+	int num = m_objectList.size();
+	snapshot.bodies.resize(num);
+	for (int i = 0; i < num; i++) {
+		BodySnapshot& b = snapshot.bodies[i];
+		dBodyID body = s.body[i];
+		const dReal* pos = dBodyGetPosition(body);
+		const dReal* q = dBodyGetQuaternion(body);
+		const dReal* vel = dBodyGetLinearVel(body);
+		const dReal* ang = dBodyGetAngularVel(body);
+		int j;
+		b.handle = m_objectList[i]->getHandle();
+		for (j = 0; j < 3; j++) {
+			b.pos[j] = pos[j];
+			b.vel[j] = vel[j];
+			b.ang[j] = ang[j];
+		}
+		for (j = 0; j < 4; j++) {
+			b.q[j] = q[j];
+			b.color[j] = s.color[i*4+j];
+		}
+		b.stillTime = s.stillTime[i];
+		b.enabled = (i < m_numActive);
+		b.inPlay = s.inPlay[i];
 	}
-	m_dynamicWaitLastTime = 0;
-	m_dynamicWaitTime = 0;
+}
+
+bool CObjectManager::RestoreState(const CSnapshot& snapshot)
+{
+	int num = snapshot.bodies.size();
+	if (num != (int)m_objectList.size()) return false;
+	int i;
+	for (i = 0; i < num; i++)
+		if (getIndex(snapshot.bodies[i].handle) < 0) return false;
 
-	return retval;
+	CObjectState& s = m_state;
+	m_numActive = 0;
+	for (i = 0; i < num; i++) {
+		const BodySnapshot& b = snapshot.bodies[i];
+		Swap(i, getIndex(b.handle));
+
+		CGameObject* obj = m_objectList[i];
+		dBodyID body = s.body[i];
+		dBodySetPosition(body, b.pos[0], b.pos[1], b.pos[2]);
+		dBodySetQuaternion(body, b.q);
+		dBodySetLinearVel(body, b.vel[0], b.vel[1], b.vel[2]);
+		dBodySetAngularVel(body, b.ang[0], b.ang[1], b.ang[2]);
+		if (b.enabled) {
+			assert(m_numActive == i);
+			m_numActive++;
+			dBodyEnable(body);
+		} else {
+			dBodyDisable(body);
+		}
+		m_sim.getODEManager().setGeomAsleep(obj->getGeomID(), !b.enabled);
+
+		s.posX[i] = s.lastX[i] = s.prevX[i] = b.pos[0];
+		s.posY[i] = s.lastY[i] = s.prevY[i] = b.pos[1];
+		s.posZ[i] = s.lastZ[i] = s.prevZ[i] = b.pos[2];
+		s.velX[i] = b.vel[0]; s.velY[i] = b.vel[1]; s.velZ[i] = b.vel[2];
+		s.angX[i] = b.ang[0]; s.angY[i] = b.ang[1]; s.angZ[i] = b.ang[2];
+		for (int j = 0; j < 4; j++) {
+			s.prevRot[i*4+j] = b.q[j];
+			s.color[i*4+j] = b.color[j];
+		}
+		s.stillTime[i] = b.stillTime;
+		s.inPlay[i] = b.inPlay;
+	}
+	return true;
 }
@@ -2,56 +2,109 @@
 //	CObjectManager
 //
 //	Manages all of our objects
+//
+//	Objects live in one dense list, awake ones first, with their hot
+//	data alongside in CObjectState.  The per-frame passes run as
+//	plain loops over the awake range; handles map to list positions.
 //-------------------------------------------------------------------
 #ifndef OBJECT_MANAGER_H
 #define OBJECT_MANAGER_H
 
 #include "CGameObject.h"
-#include "Singleton.h"
+#include "CObjectState.h"
+#include "CSnapshot.h"
 #include "ObjectFactory.h"
 
 #include <ode/ode.h>
 #include <string>
-#include <map>
 #include <vector>
 
 using std::vector;
 using std::iterator;
-using std::map;
 
 typedef vector<CGameObject*> ObjectList;
-typedef map<dBodyID, CGameObject*> ObjectIDMap;
-typedef ObjectFactory<CGameObject *(), std::string> ObjFactory;
+class CMarbleSim;
+
+typedef ObjectFactory<CGameObject *(CMarbleSim&), std::string> ObjFactory;
 // here are our object types
 static std::string Marble_Type = "marble type";
 static std::string Tolley_Type = "tolley type";
 
-class CObjectManager : public Singleton<CObjectManager>
+// one per CMarbleSim, holding that world's objects
+class CObjectManager
 {
 
 public:
 
-	CObjectManager();
+	CObjectManager(CMarbleSim& sim);
 	~CObjectManager();
 	void AddObject (CGameObject*);
+	void DestroyObject(CGameObject*);
 	void DestroyObjects();	//destroys ALL objects!
 
 	void DrawObjects();
-	void UpdateObjects();
+	void UpdateObjects();		// once per physics step
+	void StorePhysicsState();
 	
 	CGameObject* CreateObject  (std::string type);
 
 	CGameObject* getObject(dBodyID id);
+	CGameObject* getObject(ObjectHandle handle);
+	int		getNumObjects() { return m_objectList.size(); }
+
+	// where an object's data sits in the state arrays (-1 if gone)
+	int		getIndex(ObjectHandle handle);
+	CObjectState& getState() { return m_state; }
+
+	// called from CGameObject's constructor
+	void	Register(CGameObject* obj);
+
+	// copy positions and velocities out of ODE for [begin, end)
+	void	GatherState(int begin, int end);
+	void	StorePhysicsState(int begin, int end);
+	void	getInterpTransform(int index, double alpha, dReal pos[3], dMatrix3 R);
+
+	// sleeping - only awake objects are updated, stepped or collided
+	void	UpdateSleep(double stepSize);
+	void	SleepObject(CGameObject* obj);
+	void	WakeObject(CGameObject* obj);
+	bool	ResolveContactSleep(dBodyID& b1, dBodyID& b2);
+	int		getNumActive() { return m_numActive; }
+	bool	isActive(ObjectHandle handle) { return getIndex(handle) >= 0 && getIndex(handle) < m_numActive; }
+	void	setDynamicWaitTime(double t) { m_dynamicWaitTime = t; }
 
 	bool	DynamicsDone();
 
+	// every object's body, sleep state and play state; restoring puts
+	// the dense list back in the saved order too (and ODEManager puts
+	// the spaces' geoms back in theirs), so stepping on from a restore
+	// does exactly what stepping on from the save did.
+	// Fails if the objects aren't the ones that were saved.
+	void	SaveState(CSnapshot& snapshot);
+	bool	RestoreState(const CSnapshot& snapshot);
+
 private:
+	void	Swap(int a, int b);
+	void	Activate(int index);
+	void	Deactivate(int index);
+
+	// a handle's slot says where its object sits in m_objectList
+	struct HandleSlot
+	{
+		int				dense;		// index in m_objectList, -1 if free
+		unsigned int	generation;
+	};
+
+	CMarbleSim&	m_sim;
 	ObjFactory  CGameObjectFactory;
-	ObjectList	m_objectList;
-	ObjectIDMap	m_objectIDMap;
-	double		m_dynamicWaitTime;
-	double		m_dynamicWaitLastTime;
+	ObjectList	m_objectList;		// dense, no holes, awake objects first
+	vector<int>	m_denseSlots;		// slot of each m_objectList entry
+	CObjectState m_state;			// parallel to m_objectList
+	int			m_numActive;		// [0, m_numActive) are awake
+	vector<HandleSlot> m_slots;
+	vector<int>	m_freeSlots;
+	double		m_dynamicWaitTime;	// how long to be still before sleeping
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,60 @@
+#include "CObjectState.h"
+
+#include <algorithm>
+
+void CObjectState::Push(dBodyID b)
+{
+	body.push_back(b);
+	posX.push_back(0);  posY.push_back(0);  posZ.push_back(0);
+	lastX.push_back(0); lastY.push_back(0); lastZ.push_back(0);
+	velX.push_back(0);  velY.push_back(0);  velZ.push_back(0);
+	angX.push_back(0);  angY.push_back(0);  angZ.push_back(0);
+	prevX.push_back(0); prevY.push_back(0); prevZ.push_back(0);
+	prevRot.push_back(1); prevRot.push_back(0); prevRot.push_back(0); prevRot.push_back(0);
+	radius.push_back(0);
+	for (int i = 0; i < 4; i++) color.push_back(1);
+	texture.push_back((unsigned int)-1);
+	inPlay.push_back(1);
+	material.push_back(MAT_Clearie);
+	stillTime.push_back(0);
+	subStepped.push_back(0);
+}
+
+void CObjectState::Pop()
+{
+	body.pop_back();
+	posX.pop_back();  posY.pop_back();  posZ.pop_back();
+	lastX.pop_back(); lastY.pop_back(); lastZ.pop_back();
+	velX.pop_back();  velY.pop_back();  velZ.pop_back();
+	angX.pop_back();  angY.pop_back();  angZ.pop_back();
+	prevX.pop_back(); prevY.pop_back(); prevZ.pop_back();
+	prevRot.resize(prevRot.size() - 4);
+	radius.pop_back();
+	color.resize(color.size() - 4);
+	texture.pop_back();
+	inPlay.pop_back();
+	material.pop_back();
+	stillTime.pop_back();
+	subStepped.pop_back();
+}
+
+void CObjectState::Swap(int a, int b)
+{
+	if (a == b) return;
+	std::swap(body[a], body[b]);
+	std::swap(posX[a], posX[b]);   std::swap(posY[a], posY[b]);   std::swap(posZ[a], posZ[b]);
+	std::swap(lastX[a], lastX[b]); std::swap(lastY[a], lastY[b]); std::swap(lastZ[a], lastZ[b]);
+	std::swap(velX[a], velX[b]);   std::swap(velY[a], velY[b]);   std::swap(velZ[a], velZ[b]);
+	std::swap(angX[a], angX[b]);   std::swap(angY[a], angY[b]);   std::swap(angZ[a], angZ[b]);
+	std::swap(prevX[a], prevX[b]); std::swap(prevY[a], prevY[b]); std::swap(prevZ[a], prevZ[b]);
+	for (int i = 0; i < 4; i++) {
+		std::swap(prevRot[a*4+i], prevRot[b*4+i]);
+		std::swap(color[a*4+i], color[b*4+i]);
+	}
+	std::swap(radius[a], radius[b]);
+	std::swap(texture[a], texture[b]);
+	std::swap(inPlay[a], inPlay[b]);
+	std::swap(material[a], material[b]);
+	std::swap(stillTime[a], stillTime[b]);
+	std::swap(subStepped[a], subStepped[b]);
+}
@@ -0,0 +1,57 @@
+//-------------------------------------------------------------------
+//	CObjectState
+//
+//	The per-object data the hot loops touch, one array per field so
+//	a pass over positions only pulls positions through the cache.
+//	CObjectManager keeps these parallel to its dense object list,
+//	awake objects first; the CGameObject classes read and write
+//	their own entry through their index.
+//-------------------------------------------------------------------
+#ifndef COBJECT_STATE_H
+#define COBJECT_STATE_H
+
+#include <ode/ode.h>
+#include <vector>
+
+// what a surface is made of; every geom carries one in its user data
+// and each pair has its own contact parameters in ODEManager's table
+typedef enum {
+	MAT_Felt,			// the table inside the ring
+	MAT_FeltOut,		// the ground outside it (the floor geom is MAT_Felt)
+	MAT_Clearie,		// plain glass marble
+	MAT_CatsEye,
+	MAT_Tolley,
+	MAT_Obstacle,
+	MAT_NumMaterials
+} SurfaceMaterial;
+
+class CObjectState
+{
+public:
+	int		size() { return body.size(); }
+	void	Push(dBodyID b);	// defaults for everything else
+	void	Pop();
+	void	Swap(int a, int b);
+
+	std::vector<dBodyID>	body;
+
+	// copied out of ODE by GatherState
+	std::vector<dReal>		posX, posY, posZ;
+	std::vector<dReal>		lastX, lastY, lastZ;
+	std::vector<dReal>		velX, velY, velZ;
+	std::vector<dReal>		angX, angY, angZ;
+
+	// from before the last step, for render interpolation
+	std::vector<dReal>		prevX, prevY, prevZ;
+	std::vector<dReal>		prevRot;		// 4 per object, ODE quaternion order
+
+	std::vector<dReal>		radius;
+	std::vector<double>		color;			// 4 per object, rgba
+	std::vector<unsigned int> texture;		// GL texture, -1 for none
+	std::vector<unsigned char> inPlay;
+	std::vector<unsigned char> material;	// SurfaceMaterial
+	std::vector<double>		stillTime;		// how long under the sleep speed
+	std::vector<unsigned char> subStepped;	// in this step's continuous collision group
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "CReplay.h"
+#include "CMarbleSim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// doubles each action type carries
+static const int s_actionValues[RA_NumActions] = { 3, 9, 0 };
+
+//-------------------------------------------------------------------
+//	Recording
+//-------------------------------------------------------------------
+
+CReplayRecorder::CReplayRecorder()
+{
+	m_file = 0;
+	m_sim = 0;
+}
+
+CReplayRecorder::~CReplayRecorder()
+{
+	Close();
+}
+
+bool CReplayRecorder::Open(const char* fileName, CMarbleSim& sim, unsigned int seed, int numMarbles)
+{
+	Close();
+	m_file = fopen(fileName, "wb");
+	if (!m_file) return false;
+	m_sim = &sim;
+
+	ODEManager& ode = sim.getODEManager();
+	ReplayHeader h;
+	memset(&h, 0, sizeof(h));	// the padding goes to the file too
+	h.magic = REPLAY_MAGIC;
+	h.version = REPLAY_VERSION;
+	h.seed = seed;
+	h.numMarbles = numMarbles;
+	h.stepSize = ode.getStepSize();
+	h.adaptiveStep = ode.getAdaptiveStep();
+	h.continuousCollision = ode.getContinuousCollision();
+	h.broadphase = (unsigned char)ode.getBroadphase();
+	h.numTolleys = (unsigned char)sim.getNumTolleys();
+	fwrite(&h, sizeof(h), 1, m_file);
+	fflush(m_file);
+	return true;
+}
+
+void CReplayRecorder::Close()
+{
+	if (!m_file) return;
+	Write(m_sim->getODEManager().getStepCount(), RA_End, 0, 0, 0);
+	fclose(m_file);
+	m_file = 0;
+}
+
+void CReplayRecorder::Write(int step, ReplayActionType type, unsigned int handle, const double* values, int count)
+{
+	unsigned char t = (unsigned char)type;
+	fwrite(&step, sizeof(step), 1, m_file);
+	fwrite(&t, sizeof(t), 1, m_file);
+	fwrite(&handle, sizeof(handle), 1, m_file);
+	if (count) fwrite(values, sizeof(double), count, m_file);
+	fflush(m_file);
+}
+
+void CReplayRecorder::PlaceTolley(int step, CTolley* tolley, double x, double y, double z)
+{
+	if (!m_file) return;
+	double v[3] = { x, y, z };
+	Write(step, RA_PlaceTolley, tolley->getHandle(), v, 3);
+}
+
+void CReplayRecorder::Shoot(int step, CTolley* tolley, const CVector3& forward, const CVector3& side, const CVector3& aim)
+{
+	if (!m_file) return;
+	double v[9] = { forward.x, forward.y, forward.z, side.x, side.y, side.z, aim.x, aim.y, aim.z };
+	Write(step, RA_Shoot, tolley->getHandle(), v, 9);
+}
+
+//-------------------------------------------------------------------
+//	Playback
+//-------------------------------------------------------------------
+
+CReplayPlayer::CReplayPlayer()
+{
+	m_file = 0;
+}
+
+CReplayPlayer::~CReplayPlayer()
+{
+	if (m_file) fclose(m_file);
+}
+
+bool CReplayPlayer::Open(const char* fileName)
+{
+	if (m_file) fclose(m_file);
+	m_file = fopen(fileName, "rb");
+	if (!m_file) return false;
+	if (fread(&m_header, sizeof(m_header), 1, m_file) != 1 ||
+		m_header.magic != REPLAY_MAGIC || m_header.version != REPLAY_VERSION) {
+		fclose(m_file);
+		m_file = 0;
+		return false;
+	}
+	return true;
+}
+
+int CReplayPlayer::Play(CMarbleSim& sim)
+{
+	if (!m_file) return -1;
+
+	srand(m_header.seed);
+	ODEManager& ode = sim.getODEManager();
+	ode.setStepSize(m_header.stepSize);
+	ode.setAdaptiveStep(m_header.adaptiveStep != 0);
+	ode.setContinuousCollision(m_header.continuousCollision != 0);
+	ode.setBroadphase((BroadphaseType)m_header.broadphase);
+	for (int i = 1; i < m_header.numTolleys; i++)
+		sim.AddTolley();
+	sim.CreateMarbles(m_header.numMarbles);
+
+	for (;;) {
+		int step;
+		unsigned char type;
+		unsigned int handle;
+		double v[9];
+		size_t got = fread(&step, 1, sizeof(step), m_file);
+		if (got != sizeof(step)) {
+			// cut off between records: everything up to here happened
+			if (got == 0 && feof(m_file) && !ferror(m_file)) return ode.getStepCount();
+			return -1;
+		}
+		if (fread(&type, sizeof(type), 1, m_file) != 1 ||
+			fread(&handle, sizeof(handle), 1, m_file) != 1 ||
+			type >= RA_NumActions ||
+			(int)fread(v, sizeof(double), s_actionValues[type], m_file) != s_actionValues[type])
+			return -1;
+
+		// actions come in between steps, in the order they were made
+		if (step < ode.getStepCount()) return -1;
+		sim.Advance(step - ode.getStepCount());
+		if (type == RA_End) return step;
+
+		CTolley* tolley = (CTolley*)sim.getObjectManager().getObject(handle);
+		if (!tolley) return -1;
+		if (type == RA_PlaceTolley)
+			tolley->setPos(v[0], v[1], v[2]);
+		else
+			sim.ShootMarble(tolley, CVector3(v[0], v[1], v[2]), CVector3(v[3], v[4], v[5]),
+							CVector3(v[6], v[7], v[8]));
+	}
+}
@@ -0,0 +1,91 @@
+//-------------------------------------------------------------------
+//	CReplay
+//
+//	Records a session as the things that can change what happens:
+//	the rand seed, the table's settings and every player action,
+//	each stamped with the step it came in before.  Everything else
+//	follows from those, so CReplayPlayer can run the steps back to
+//	back at full speed and end with the world exactly as it was.
+//
+//	The stream is a ReplayHeader, then per action its step, type and
+//	object handle and the doubles that type carries, then an
+//	RA_End record with the last step.  Each record is flushed as it's
+//	written, so a session that never got to close (it crashed) still
+//	leaves a stream that plays up to its last action.
+//-------------------------------------------------------------------
+#ifndef CREPLAY_H
+#define CREPLAY_H
+
+#include "CVector3.h"
+
+#include <stdio.h>
+
+#define REPLAY_MAGIC	0x4c50524d		// "MRPL"
+#define REPLAY_VERSION	1
+
+class CMarbleSim;
+class CTolley;
+
+typedef enum {
+	RA_PlaceTolley,		// x y z
+	RA_Shoot,			// forward, side and aim, 3 each
+	RA_End,				// no more actions; play on to this step
+	RA_NumActions
+} ReplayActionType;
+
+struct ReplayHeader
+{
+	unsigned int	magic;
+	unsigned int	version;
+	unsigned int	seed;			// what srand was given
+	int				numMarbles;		// racked before step 0
+	double			stepSize;		// fixed step, or the first adaptive one
+	unsigned char	adaptiveStep;
+	unsigned char	continuousCollision;
+	unsigned char	broadphase;		// BroadphaseType
+	unsigned char	numTolleys;		// added before racking; 0 from before there were two
+};
+
+class CReplayRecorder
+{
+public:
+	CReplayRecorder();
+	~CReplayRecorder();
+
+	// takes the settings from the sim as it is now, before any steps
+	bool	Open(const char* fileName, CMarbleSim& sim, unsigned int seed, int numMarbles);
+	void	Close();
+	bool	isOpen() { return m_file != 0; }
+
+	void	PlaceTolley(int step, CTolley* tolley, double x, double y, double z);
+	void	Shoot(int step, CTolley* tolley, const CVector3& forward, const CVector3& side, const CVector3& aim);
+
+private:
+	void	Write(int step, ReplayActionType type, unsigned int handle, const double* values, int count);
+
+	FILE*	m_file;
+	CMarbleSim* m_sim;
+};
+
+class CReplayPlayer
+{
+public:
+	CReplayPlayer();
+	~CReplayPlayer();
+
+	bool	Open(const char* fileName);
+	const ReplayHeader& getHeader() { return m_header; }
+
+	// sets the sim up from the header, racks it and runs every step of
+	// the recording with the actions in between; sim must be new.
+	// A stream that stops between records without an RA_End plays up
+	// to its last action.  Returns the steps run, or -1 if the stream
+	// is bad.
+	int		Play(CMarbleSim& sim);
+
+private:
+	FILE*	m_file;
+	ReplayHeader m_header;
+};
+
+#endif
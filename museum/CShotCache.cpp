@@ -0,0 +1,220 @@
+#include "CShotCache.h"
+#include "CSnapshot.h"
+#include "CStateHash.h"
+#include "CThreads.h"
+
+#include <cmath>
+#include <string.h>
+
+CShotCache::CShotCache(int slots)
+{
+	// a power of two of sets, so a key's set is just its low bits
+	m_numSets = 1;
+	while (m_numSets*CACHE_WAYS < slots)
+		m_numSets <<= 1;
+	m_slots = new Slot[m_numSets*CACHE_WAYS];
+	m_numBodies = 0;
+	m_handles = 0;
+	m_rest = 0;
+	m_clock = 0;
+	Clear();
+	ResetStats();
+}
+
+CShotCache::~CShotCache()
+{
+	delete [] m_slots;
+	delete [] m_handles;
+	delete [] m_rest;
+}
+
+void
+CShotCache::setNumBodies(int bodies)
+{
+	if (bodies == m_numBodies) {
+		Clear();
+		return;
+	}
+	delete [] m_handles;
+	delete [] m_rest;
+	int slots = m_numSets*CACHE_WAYS;
+	m_numBodies = bodies;
+	m_handles = new unsigned int[slots*bodies*3];
+	m_rest = new double[slots*bodies*3];
+	Clear();
+}
+
+void
+CShotCache::Clear()
+{
+	memset(m_slots, 0, m_numSets*CACHE_WAYS*sizeof(Slot));
+}
+
+void
+CShotCache::ResetStats()
+{
+	m_lookups = m_hits = m_inserts = m_evictions = m_busy = 0;
+}
+
+//-------------------------------------------------------------------
+//	Keys
+//-------------------------------------------------------------------
+
+static int Quantize(double v, double quantum)
+{
+	return (int)floor(v/quantum + 0.5);
+}
+
+// two differently mixed lanes, 64 bits of key between them
+static void AddWord(ShotKey& key, unsigned int word)
+{
+	key.a = CStateHash::Mix(key.a + word*0x9e3779b1u);
+	key.b = CStateHash::Mix((key.b ^ word) + 0x7f4a7c15u + (key.b << 6));
+}
+
+static void AddVector(ShotKey& key, const CVector3& v)
+{
+	AddWord(key, Quantize(v.x, CACHE_SHOT_QUANTUM));
+	AddWord(key, Quantize(v.y, CACHE_SHOT_QUANTUM));
+	AddWord(key, Quantize(v.z, CACHE_SHOT_QUANTUM));
+}
+
+// the bodies are summed, so the order the snapshot has them in
+// (which depends on who's asleep) doesn't matter
+ShotKey
+CShotCache::TableKey(const CSnapshot& table)
+{
+	ShotKey key = { 0, 0 };
+	for (unsigned int i = 0; i < table.bodies.size(); i++) {
+		const BodySnapshot& b = table.bodies[i];
+		ShotKey body = { 1, 2 };
+		AddWord(body, b.handle);
+		AddWord(body, Quantize(b.pos[0], CACHE_POS_QUANTUM));
+		AddWord(body, Quantize(b.pos[1], CACHE_POS_QUANTUM));
+		AddWord(body, Quantize(b.pos[2], CACHE_POS_QUANTUM));
+		AddWord(body, b.inPlay);
+		key.a += body.a;
+		key.b += body.b;
+	}
+	return key;
+}
+
+ShotKey
+CShotCache::Key(const ShotKey& table, const CVector3& aim, const CVector3& forward, const CVector3& side)
+{
+	ShotKey key = table;
+	AddVector(key, aim);
+	AddVector(key, forward);
+	AddVector(key, side);
+	return key;
+}
+
+void
+CShotCache::Snap(CVector3& v)
+{
+	v.x = Quantize(v.x, CACHE_SHOT_QUANTUM)*CACHE_SHOT_QUANTUM;
+	v.y = Quantize(v.y, CACHE_SHOT_QUANTUM)*CACHE_SHOT_QUANTUM;
+	v.z = Quantize(v.z, CACHE_SHOT_QUANTUM)*CACHE_SHOT_QUANTUM;
+}
+
+//-------------------------------------------------------------------
+//	Lookup and insert
+//
+//	A reader takes the version, copies the slot out and takes the
+//	version again; the copy only counts if neither was odd and they
+//	match.  A writer makes the version odd with a compare-exchange,
+//	so only one can have a slot, and even again once it's done.
+//-------------------------------------------------------------------
+
+bool
+CShotCache::Lookup(const ShotKey& key, ShotResult& result)
+{
+	AtomicIncrement(&m_lookups);
+	Slot* set = m_slots + (key.a & (m_numSets - 1))*CACHE_WAYS;
+	for (int i = 0; i < CACHE_WAYS; i++) {
+		Slot& slot = set[i];
+		long version = slot.version;
+		if (version == 0 || (version & 1))
+			continue;
+		MemoryFence();
+		if (slot.keyA != key.a || slot.keyB != key.b)
+			continue;
+
+		// a torn read can have any counts at all, so check them first
+		int numHit = slot.numHit, numOut = slot.numOut, numBodies = slot.numBodies;
+		if (numHit < 0 || numHit > m_numBodies || numOut < 0 || numOut > m_numBodies ||
+			numBodies < 0 || numBodies > m_numBodies)
+			return false;
+		int n = &slot - m_slots;
+		const unsigned int* handles = m_handles + n*m_numBodies*3;
+		const double* rest = m_rest + n*m_numBodies*3;
+		result.hit.assign(handles, handles + numHit);
+		result.out.assign(handles + m_numBodies, handles + m_numBodies + numOut);
+		result.handle.assign(handles + m_numBodies*2, handles + m_numBodies*2 + numBodies);
+		result.rest.assign(rest, rest + numBodies*3);
+
+		MemoryFence();
+		if (slot.version != version)
+			return false;
+		slot.lastUse = AtomicIncrement(&m_clock);
+		AtomicIncrement(&m_hits);
+		return true;
+	}
+	return false;
+}
+
+void
+CShotCache::Insert(const ShotKey& key, const ShotResult& result)
+{
+	int numBodies = result.handle.size();
+	if (numBodies > m_numBodies || (int)result.hit.size() > m_numBodies ||
+		(int)result.out.size() > m_numBodies)
+		return;
+
+	// the key's own slot if it's there already, or an empty one, or
+	// the one used longest ago
+	Slot* set = m_slots + (key.a & (m_numSets - 1))*CACHE_WAYS;
+	Slot* victim = 0;
+	int i;
+	for (i = 0; i < CACHE_WAYS; i++) {
+		if (set[i].version != 0 && set[i].keyA == key.a && set[i].keyB == key.b)
+			return;
+		if (set[i].version == 0) {
+			victim = &set[i];
+			break;
+		}
+		if (!victim || set[i].lastUse < victim->lastUse)
+			victim = &set[i];
+	}
+
+	long version = victim->version;
+	if ((version & 1) || AtomicCompareExchange(&victim->version, version + 1, version) != version) {
+		AtomicIncrement(&m_busy);
+		return;
+	}
+	if (version != 0)
+		AtomicIncrement(&m_evictions);
+
+	int n = victim - m_slots;
+	unsigned int* handles = m_handles + n*m_numBodies*3;
+	double* rest = m_rest + n*m_numBodies*3;
+	for (i = 0; i < (int)result.hit.size(); i++)
+		handles[i] = result.hit[i];
+	for (i = 0; i < (int)result.out.size(); i++)
+		handles[m_numBodies + i] = result.out[i];
+	for (i = 0; i < numBodies; i++) {
+		handles[m_numBodies*2 + i] = result.handle[i];
+		rest[i*3] = result.rest[i*3];
+		rest[i*3+1] = result.rest[i*3+1];
+		rest[i*3+2] = result.rest[i*3+2];
+	}
+	victim->keyA = key.a;
+	victim->keyB = key.b;
+	victim->numHit = result.hit.size();
+	victim->numOut = result.out.size();
+	victim->numBodies = numBodies;
+	victim->lastUse = AtomicIncrement(&m_clock);
+
+	AtomicIncrement(&victim->version);
+	AtomicIncrement(&m_inserts);
+}
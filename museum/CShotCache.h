@@ -0,0 +1,104 @@
+//-------------------------------------------------------------------
+//	CShotCache
+//
+//	Remembers what shots did, so the same shot off the same table is
+//	only played out once however many times it's asked about.  A key
+//	hashes the table's positions and the shot, each rounded to a
+//	quantum first; tables and shots that close are taken to be the
+//	same.  Shots snapped to the quantum (Snap) come back exactly.
+//
+//	It's a fixed number of slots, CACHE_WAYS to a set, and a full
+//	set drops whichever slot was used longest ago.  Any number of
+//	threads can look up and insert at once without a lock: a slot's
+//	version is odd while it's being written, and a reader that sees
+//	it change while copying out takes that as a miss.  A writer that
+//	finds its slot already being written just doesn't bother.
+//-------------------------------------------------------------------
+#ifndef CSHOT_CACHE_H
+#define CSHOT_CACHE_H
+
+#include "CVector3.h"
+
+#include <vector>
+
+#define CACHE_WAYS			4		// slots a key can go in
+#define CACHE_POS_QUANTUM	0.01	// positions closer than this are the same
+#define CACHE_SHOT_QUANTUM	0.05	// and shots, in ShootMarble's units
+
+class CSnapshot;
+
+struct ShotKey
+{
+	unsigned int	a;
+	unsigned int	b;
+};
+
+// what a shot did, by object handle
+struct ShotResult
+{
+	std::vector<unsigned int>	hit;		// marbles the tolley hit
+	std::vector<unsigned int>	out;		// marbles that left the ring
+	std::vector<unsigned int>	handle;		// every body...
+	std::vector<double>			rest;		// ...and where it stopped, x y z each
+};
+
+class CShotCache
+{
+public:
+	CShotCache(int slots);
+	~CShotCache();
+
+	// how many bodies a result can have; empties the cache, and isn't
+	// to be called while anyone's using it
+	void	setNumBodies(int bodies);
+	void	Clear();
+
+	static ShotKey TableKey(const CSnapshot& table);
+	static ShotKey Key(const ShotKey& table, const CVector3& aim, const CVector3& forward, const CVector3& side);
+	// rounds a shot's vector to the quantum
+	static void Snap(CVector3& v);
+
+	bool	Lookup(const ShotKey& key, ShotResult& result);
+	void	Insert(const ShotKey& key, const ShotResult& result);
+
+	// since the last ResetStats
+	int		getLookups() { return m_lookups; }
+	int		getHits() { return m_hits; }
+	int		getInserts() { return m_inserts; }
+	int		getEvictions() { return m_evictions; }
+	int		getBusy() { return m_busy; }		// inserts given up on
+	double	getHitRate() { return m_lookups ? (double)m_hits/m_lookups : 0; }
+	void	ResetStats();
+
+private:
+	CShotCache(const CShotCache&);
+	CShotCache& operator=(const CShotCache&);
+
+	struct Slot
+	{
+		volatile long	version;	// 0 empty, odd while being written
+		volatile long	lastUse;
+		unsigned int	keyA;
+		unsigned int	keyB;
+		int				numHit;
+		int				numOut;
+		int				numBodies;
+	};
+
+	int		m_numSets;
+	int		m_numBodies;
+	Slot*	m_slots;
+	// each slot's share: m_numBodies each of hit, out and body handles,
+	// and 3 doubles a body of rest positions
+	unsigned int*	m_handles;
+	double*			m_rest;
+
+	volatile long	m_clock;
+	volatile long	m_lookups;
+	volatile long	m_hits;
+	volatile long	m_inserts;
+	volatile long	m_evictions;
+	volatile long	m_busy;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "CShotPreview.h"
+#include "CMarble.h"
+#include "CTimer.h"
+
+static bool Same(const CVector3& a, const CVector3& b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+CShotPreview::CShotPreview()
+{
+	m_haveTable = false;
+	m_aimed = false;
+	m_contact = false;
+	m_restart = false;
+	m_done = true;
+	m_steps = 0;
+	m_startCost = 0;
+	m_stepCost = 0;
+	m_world.setCollisionListener(this);
+}
+
+bool
+CShotPreview::CreateMarbles(int number, int tolleys)
+{
+	while (m_world.getNumTolleys() < tolleys)
+		m_world.AddTolley();
+	return m_world.CreateMarbles(number);
+}
+
+//-------------------------------------------------------------------
+//	Settles on a table to shoot at.  The step settings come along
+//	too, or the path wouldn't be the one the real shot takes.  The
+//	table has to be saved now, before it moves on, but restoring it
+//	waits for Refine.
+//-------------------------------------------------------------------
+bool
+CShotPreview::setTable(CMarbleSim& table)
+{
+	m_world.getODEManager().CopySettings(table.getODEManager());
+	table.getODEManager().SaveSnapshot(m_table);
+
+	m_haveTable = (int)m_table.bodies.size() == m_world.getObjectManager().getNumObjects();
+	if (m_aimed)
+		Restart();
+	return m_haveTable;
+}
+
+void
+CShotPreview::Aim(const CVector3& tolleyPos, const CVector3& forward, const CVector3& side, const CVector3& aim)
+{
+	if (m_aimed && Same(tolleyPos, m_tolleyPos) && Same(forward, m_forward) &&
+		Same(side, m_side) && Same(aim, m_aim))
+		return;
+	m_tolleyPos = tolleyPos;
+	m_forward = forward;
+	m_side = side;
+	m_aim = aim;
+	m_aimed = true;
+	Restart();
+}
+
+// the old path's no good any more, whether or not there's time to
+// start the new one this frame
+void
+CShotPreview::Restart()
+{
+	m_path.clear();
+	m_contact = false;
+	m_steps = 0;
+	m_done = true;
+	m_restart = m_haveTable;
+}
+
+//-------------------------------------------------------------------
+//	Back to the table as it was, and take the shot
+//-------------------------------------------------------------------
+void
+CShotPreview::Start()
+{
+	m_restart = false;
+	if (!m_world.getODEManager().RestoreSnapshot(m_table))
+		return;
+
+	CTolley* tolley = m_world.getTolley();
+	tolley->setPos(m_tolleyPos.x, m_tolleyPos.y, m_tolleyPos.z);
+	m_world.ShootMarble(tolley, m_forward, m_side, m_aim);
+	AddPoint();
+	m_done = false;
+}
+
+static double Smooth(double cost, double took)
+{
+	return (cost == 0) ? took : cost*0.9 + took*0.1;
+}
+
+//-------------------------------------------------------------------
+//	Sets up and steps until the next thing looks like it would go
+//	over the budget.  An estimate too big for a whole frame would
+//	never be tried again to find out it's wrong, so a frame it keeps
+//	idle shrinks it a little, and a slow machine still gets there.
+//-------------------------------------------------------------------
+int
+CShotPreview::Refine(double budget)
+{
+	double start = CTimer::getSeconds();
+	double now = start;
+	if (m_restart) {
+		if (m_startCost > budget) {
+			m_startCost *= PREVIEW_COST_DECAY;
+			return 0;
+		}
+		Start();
+		now = CTimer::getSeconds();
+		m_startCost = Smooth(m_startCost, now - start);
+	}
+
+	int steps = 0;
+	while (!m_done) {
+		if (now - start + m_stepCost > budget) {
+			if (now == start)
+				m_stepCost *= PREVIEW_COST_DECAY;
+			break;
+		}
+
+		m_world.Advance(1);
+		m_steps++;
+		steps++;
+		AddPoint();
+
+		double last = now;
+		now = CTimer::getSeconds();
+		m_stepCost = Smooth(m_stepCost, now - last);
+
+		if (m_contact || m_steps >= PREVIEW_MAX_STEPS || m_world.DynamicsDone())
+			m_done = true;
+	}
+	return steps;
+}
+
+void
+CShotPreview::AddPoint()
+{
+	const double* pos = m_world.getTolley()->getPos();
+	m_path.push_back(pos[0]);
+	m_path.push_back(pos[1]);
+	m_path.push_back(pos[2]);
+}
+
+//-------------------------------------------------------------------
+//	The first marble the tolley hits ends the preview
+//-------------------------------------------------------------------
+void
+CShotPreview::OnImpact(CMarble* m1, CMarble* m2, double speed)
+{
+	CTolley* tolley = m_world.getTolley();
+	if (m_contact || (m1 != tolley && m2 != tolley))
+		return;
+	m_contact = true;
+	const double* pos = tolley->getPos();
+	m_contactPos[0] = pos[0];
+	m_contactPos[1] = pos[1];
+	m_contactPos[2] = pos[2];
+}
+
+void
+CShotPreview::OnRingOut(CMarble* m)
+{
+	if (m == m_world.getTolley())
+		m_done = true;
+}
@@ -0,0 +1,82 @@
+//-------------------------------------------------------------------
+//	CShotPreview
+//
+//	Shows where a shot will go before it's taken.  A world of its own,
+//	racked like the table, is restored from a snapshot of the table,
+//	the tolley put where the player has it and shot with the same
+//	math as the real shot, then stepped on.  The tolley's path and
+//	where it first hits a marble are what the renderer draws.
+//
+//	It's stepped a little at a time under a budget of seconds per
+//	frame, so aiming never drops a frame; the path grows across frames
+//	until the tolley hits something, stops or leaves the ring.  An aim
+//	that hasn't moved keeps what's already been worked out.  Setting
+//	the shot up again (the restore and the shot) is done by Refine
+//	too and comes out of the same budget, and nothing is started that
+//	doesn't look like it would fit in what's left of it.
+//-------------------------------------------------------------------
+#ifndef CSHOT_PREVIEW_H
+#define CSHOT_PREVIEW_H
+
+#include "CMarbleSim.h"
+#include "CSnapshot.h"
+#include "CVector3.h"
+
+#include <vector>
+
+#define PREVIEW_MAX_STEPS	200		// give up on a shot that goes nowhere after this
+#define PREVIEW_COST_DECAY	0.9		// a cost estimate that kept a whole frame idle shrinks by this
+
+class CShotPreview : public CCollisionListener
+{
+public:
+	CShotPreview();
+
+	// the same numbers as the table has, or its snapshots won't fit
+	bool	CreateMarbles(int number, int tolleys = 1);
+	// takes a snapshot of the table and its settings; the path starts again
+	bool	setTable(CMarbleSim& table);
+	// the shot being lined up; the same one as last time is left alone
+	void	Aim(const CVector3& tolleyPos, const CVector3& forward, const CVector3& side, const CVector3& aim);
+	// sets the shot up if it has to be and steps it on, as much of that
+	// as fits in budget seconds; returns the steps taken
+	int		Refine(double budget);
+
+	bool	isDone() { return m_done && !m_restart; }
+	// the tolley's position after every step so far, 3 doubles each
+	int		getNumPoints() { return m_path.size()/3; }
+	const double* getPath() { return m_path.empty() ? 0 : &m_path[0]; }
+	// where the tolley was when it first hit a marble, if it has
+	bool	hasContact() { return m_contact; }
+	const double* getContact() { return m_contactPos; }
+
+	virtual void OnImpact(CMarble* m1, CMarble* m2, double speed);
+	virtual void OnRingOut(CMarble* m);
+
+private:
+	void	Restart();
+	void	Start();
+	void	AddPoint();
+
+	CMarbleSim	m_world;
+	CSnapshot	m_table;
+	bool		m_haveTable;
+
+	// the shot the path belongs to
+	CVector3	m_tolleyPos;
+	CVector3	m_forward;
+	CVector3	m_side;
+	CVector3	m_aim;
+	bool		m_aimed;
+
+	std::vector<double> m_path;
+	bool		m_contact;
+	double		m_contactPos[3];
+	bool		m_restart;		// the shot has to be set up again first
+	bool		m_done;
+	int			m_steps;
+	double		m_startCost;	// seconds setting up has been taking, smoothed
+	double		m_stepCost;		// and a step
+};
+
+#endif
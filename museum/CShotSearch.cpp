@@ -0,0 +1,324 @@
+#include "CShotSearch.h"
+#include "CMarble.h"
+#include "CStateHash.h"
+#include "CTimer.h"
+
+#include <math.h>
+
+//-------------------------------------------------------------------
+//	CShotOutcome
+//-------------------------------------------------------------------
+void
+CShotOutcome::Reset(CTolley* tolley)
+{
+	m_tolley = tolley;
+	m_hits.clear();
+	m_outs.clear();
+}
+
+void
+CShotOutcome::OnImpact(CMarble* m1, CMarble* m2, double speed)
+{
+	CMarble* hit;
+	if (m1 == m_tolley) hit = m2;
+	else if (m2 == m_tolley) hit = m1;
+	else return;
+	// the other player's tolley isn't a marble in the game
+	if (hit->getMaterial() == MAT_Tolley)
+		return;
+
+	for (unsigned int i = 0; i < m_hits.size(); i++)
+		if (m_hits[i] == hit) return;
+	m_hits.push_back(hit);
+}
+
+void
+CShotOutcome::OnRingOut(CMarble* m)
+{
+	if (m != m_tolley)
+		m_outs.push_back(m);
+}
+
+//-------------------------------------------------------------------
+//	CShotSearch
+//-------------------------------------------------------------------
+// a worker for every searcher; the thread that made us only waits
+CShotSearch::CShotSearch(int threads)
+	: m_pool((threads > 0 ? threads : GetNumCores()) + 1, &ODEManager::AttachThread, &ODEManager::DetachThread),
+	  m_cache(SEARCH_CACHE_SLOTS)
+{
+	m_searchers.resize(m_pool.getNumThreads() - 1);
+	for (unsigned int i = 0; i < m_searchers.size(); i++) {
+		Searcher& s = m_searchers[i];
+		s.world = new CMarbleSim();
+		s.world->setCollisionListener(&s.outcome);
+		s.seed = 0;
+		s.best.valid = false;
+		s.tried = 0;
+	}
+	m_tableKey.a = m_tableKey.b = 0;
+	m_tolley = 0;
+	m_deadline = 0;
+	m_stop = 0;
+	m_best.valid = false;
+	m_tried = 0;
+	m_done = true;
+}
+
+CShotSearch::~CShotSearch()
+{
+	Cancel();
+	for (unsigned int i = 0; i < m_searchers.size(); i++)
+		delete m_searchers[i].world;
+}
+
+bool
+CShotSearch::CreateMarbles(int number, int tolleys)
+{
+	bool ok = true;
+	for (unsigned int i = 0; i < m_searchers.size(); i++) {
+		CMarbleSim* world = m_searchers[i].world;
+		while (world->getNumTolleys() < tolleys)
+			world->AddTolley();
+		ok = world->CreateMarbles(number) && ok;
+	}
+	m_cache.setNumBodies(m_searchers[0].world->getObjectManager().getNumObjects());
+	return ok;
+}
+
+double
+CShotSearch::getBudget(AILevel level)
+{
+	switch (level) {
+	case AI_Easy:	return 0.25;
+	case AI_Normal:	return 1.0;
+	case AI_Hard:	return 4.0;
+	default:		return 1.0;
+	}
+}
+
+const char*
+CShotSearch::getLevelName(AILevel level)
+{
+	switch (level) {
+	case AI_Easy:	return "easy";
+	case AI_Normal:	return "normal";
+	case AI_Hard:	return "hard";
+	default:		return "?";
+	}
+}
+
+//-------------------------------------------------------------------
+//	Takes the table down to what a search needs: a snapshot to start
+//	every shot from, where the tolley is and what there is to aim at.
+//	The tolley goes by handle, the same in every world.
+//-------------------------------------------------------------------
+void
+CShotSearch::Begin(CMarbleSim& table, CTolley* tolley, double budget, unsigned int seed)
+{
+	Cancel();
+	table.getODEManager().SaveSnapshot(m_table);
+	m_tableKey = CShotCache::TableKey(m_table);
+	m_tolley = tolley->getHandle();
+	const double* pos = tolley->getPos();
+	m_tolleyPos.set(pos[0], pos[1], pos[2]);
+
+	// the shooter's own tolley or anyone else's isn't something to hit
+	m_targets.clear();
+	std::vector<CMarble*>& marbles = table.getMarbles();
+	for (unsigned int i = 0; i < marbles.size(); i++) {
+		if (marbles[i]->getMaterial() == MAT_Tolley || !marbles[i]->isInPlay())
+			continue;
+		pos = marbles[i]->getPos();
+		m_targets.push_back(CVector3(pos[0], pos[1], pos[2]));
+	}
+
+	for (unsigned int i = 0; i < m_searchers.size(); i++) {
+		Searcher& s = m_searchers[i];
+		s.world->getODEManager().CopySettings(table.getODEManager());
+		s.seed = seed + i*7919;
+		s.best.valid = false;
+		s.tried = 0;
+	}
+	m_deadline = CTimer::getSeconds() + budget;
+	m_stop = 0;
+	m_best.valid = false;
+	m_tried = 0;
+	m_done = false;
+	m_pool.Start(&CShotSearch::SearchTask, this, m_searchers.size());
+}
+
+bool
+CShotSearch::Poll()
+{
+	if (!m_done && m_pool.isFinished())
+		Finish();
+	return m_done;
+}
+
+void
+CShotSearch::Wait()
+{
+	if (!m_done)
+		Finish();
+}
+
+void
+CShotSearch::Cancel()
+{
+	if (m_done)
+		return;
+	m_stop = 1;
+	Finish();
+}
+
+void
+CShotSearch::Finish()
+{
+	m_pool.Wait();
+
+	// in searcher order, so a tie goes the same way however the
+	// threads ran
+	m_tried = 0;
+	for (unsigned int i = 0; i < m_searchers.size(); i++) {
+		Searcher& s = m_searchers[i];
+		m_tried += s.tried;
+		if (s.best.valid && (!m_best.valid || Better(s.best, m_best)))
+			m_best = s.best;
+	}
+	m_done = true;
+}
+
+void
+CShotSearch::SearchTask(void* data, int task)
+{
+	CShotSearch* search = (CShotSearch*)data;
+	search->Search(search->m_searchers[task]);
+}
+
+// always tries one, so even no time at all gives a shot
+void
+CShotSearch::Search(Searcher& s)
+{
+	do {
+		ShotChoice shot;
+		Sample(s, shot);
+		Play(s, shot);
+		s.tried++;
+		if (shot.valid && (!s.best.valid || Better(shot, s.best)))
+			s.best = shot;
+	} while (!m_stop && CTimer::getSeconds() < m_deadline);
+}
+
+// rand() isn't ours to share between threads
+static double Random(unsigned int& seed)
+{
+	seed = seed*1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff)/32767.0;
+}
+
+//-------------------------------------------------------------------
+//	A shot a player might try: aimed at or just off a marble, harder
+//	or softer than the aim says, with a little spin either way
+//-------------------------------------------------------------------
+void
+CShotSearch::Sample(Searcher& s, ShotChoice& shot)
+{
+	CVector3 target(0, 0, 0);
+	if (!m_targets.empty()) {
+		int i = (int)(Random(s.seed)*m_targets.size());
+		if (i >= (int)m_targets.size()) i = m_targets.size() - 1;
+		target = m_targets[i];
+	}
+	target.x += (Random(s.seed)*2 - 1)*MARBLE_RADIUS*2;
+	target.z += (Random(s.seed)*2 - 1)*MARBLE_RADIUS*2;
+	double power = 0.5 + Random(s.seed)*1.5;
+	shot.aim = (target - m_tolleyPos)*power;
+
+	// the same frame the aiming controls use
+	CVector3 back = m_tolleyPos - target;
+	back.y = 0;
+	back.Normalize();
+	CVector3 up(0, 1, 0);
+	CVector3 strafe;
+	strafe.Cross(back, up);
+	strafe.Normalize();
+	shot.forward = strafe*((Random(s.seed)*2 - 1)*SEARCH_MAX_SPIN);
+	shot.side = back*((Random(s.seed)*2 - 1)*SEARCH_MAX_SPIN);
+	CShotCache::Snap(shot.aim);
+	CShotCache::Snap(shot.forward);
+	CShotCache::Snap(shot.side);
+}
+
+void
+CShotSearch::Play(Searcher& s, ShotChoice& shot)
+{
+	// the same shot by the other tolley is another shot
+	ShotKey table = m_tableKey;
+	table.a ^= CStateHash::Mix(m_tolley);
+	ShotKey key = CShotCache::Key(table, shot.aim, shot.forward, shot.side);
+	if (m_cache.Lookup(key, s.result)) {
+		Score(shot, s.result, m_tolley);
+		return;
+	}
+
+	CMarbleSim& world = *s.world;
+	if (!world.getODEManager().RestoreSnapshot(m_table)) {
+		shot.valid = false;
+		return;
+	}
+	CTolley* tolley = (CTolley*)world.getObjectManager().getObject((ObjectHandle)m_tolley);
+	s.outcome.Reset(tolley);
+	world.ShootMarble(tolley, shot.forward, shot.side, shot.aim);
+	for (int i = 0; i < SEARCH_MAX_STEPS; i++) {
+		world.Advance(1);
+		if (world.DynamicsDone())
+			break;
+	}
+
+	ShotResult& result = s.result;
+	CShotOutcome& outcome = s.outcome;
+	int i;
+	result.hit.resize(outcome.getHits());
+	for (i = 0; i < outcome.getHits(); i++)
+		result.hit[i] = outcome.getHit(i)->getHandle();
+	result.out.resize(outcome.getRingOuts());
+	for (i = 0; i < outcome.getRingOuts(); i++)
+		result.out[i] = outcome.getRingOut(i)->getHandle();
+	std::vector<CMarble*>& marbles = world.getMarbles();
+	result.handle.resize(marbles.size());
+	result.rest.resize(marbles.size()*3);
+	for (i = 0; i < (int)marbles.size(); i++) {
+		const double* pos = marbles[i]->getPos();
+		result.handle[i] = marbles[i]->getHandle();
+		result.rest[i*3] = pos[0];
+		result.rest[i*3+1] = pos[1];
+		result.rest[i*3+2] = pos[2];
+	}
+	m_cache.Insert(key, result);
+	Score(shot, result, m_tolley);
+}
+
+void
+CShotSearch::Score(ShotChoice& shot, const ShotResult& result, unsigned int tolley)
+{
+	shot.hits = result.hit.size();
+	shot.ringOuts = result.out.size();
+	shot.value = CShotOutcome::Points(shot.hits);
+	shot.leave = 0;
+	for (unsigned int i = 0; i < result.handle.size(); i++) {
+		if (result.handle[i] != tolley) continue;
+		const double* pos = &result.rest[i*3];
+		shot.leave = sqrt(pos[0]*pos[0] + pos[2]*pos[2]);
+		break;
+	}
+	shot.valid = true;
+}
+
+bool
+CShotSearch::Better(const ShotChoice& a, const ShotChoice& b)
+{
+	if (a.value != b.value)
+		return a.value > b.value;
+	return a.leave < b.leave;
+}
@@ -0,0 +1,155 @@
+//-------------------------------------------------------------------
+//	CShotSearch
+//
+//	The computer player.  It tries shots at random, each one played
+//	out in a world of its own restored from a snapshot of the table,
+//	and keeps the one that scores best under the rules (CShotOutcome).
+//	A shot only scores a point or nothing, so between two that score
+//	the same the better is the one that leaves the tolley nearer the
+//	middle of the ring: it stays in to shoot again, closer to what's
+//	left.  That way the longer it looks the better the shot it keeps.
+//	Every core gets a world and tries shots until time's up, so it
+//	can be stopped whenever and still has the best shot so far; the
+//	harder it plays, the longer it's given.  The search runs on the
+//	pool's own threads, so a game only has to poll it between frames.
+//
+//	A shot is what a player could do: aim somewhere near a marble,
+//	shoot as hard as the aim's distance says (give or take), with
+//	forward and side spin off the mouse, through CMarbleSim::ShootMarble.
+//	Shots are snapped to CShotCache's quantum, and any that have been
+//	played out before on this table come out of the cache instead.
+//-------------------------------------------------------------------
+#ifndef CSHOT_SEARCH_H
+#define CSHOT_SEARCH_H
+
+#include "CMarbleSim.h"
+#include "CShotCache.h"
+#include "CSnapshot.h"
+#include "CThreads.h"
+#include "CVector3.h"
+
+#include <vector>
+
+#define SEARCH_MAX_STEPS	400		// a shot still going after this is scored as it is
+#define SEARCH_MAX_SPIN		30.0	// about as much spin as a hard pull of the mouse
+#define SEARCH_CACHE_SLOTS	16384
+
+typedef enum {
+	AI_Easy,
+	AI_Normal,
+	AI_Hard,
+	AI_NumLevels
+} AILevel;
+
+//-------------------------------------------------------------------
+//	What a shot did, by the rules: the shooter scores for hitting
+//	exactly one marble with the tolley.  Ring-outs are kept track of
+//	but don't score.  Listens to the world it's given.
+//-------------------------------------------------------------------
+class CShotOutcome : public CCollisionListener
+{
+public:
+	CShotOutcome() : m_tolley(0) {}
+
+	// a new shot by this tolley
+	void	Reset(CTolley* tolley);
+
+	virtual void OnImpact(CMarble* m1, CMarble* m2, double speed);
+	virtual void OnRingOut(CMarble* m);
+
+	int		getHits() { return m_hits.size(); }		// different marbles the tolley hit
+	int		getRingOuts() { return m_outs.size(); }
+	CMarble* getHit(int i) { return m_hits[i]; }
+	CMarble* getRingOut(int i) { return m_outs[i]; }
+	int		getShooterPoints() { return Points(m_hits.size()); }
+
+	// the shooter's points for hitting this many marbles
+	static int Points(int hits) { return (hits == 1) ? 1 : 0; }
+
+private:
+	CTolley*				m_tolley;
+	std::vector<CMarble*>	m_hits;
+	std::vector<CMarble*>	m_outs;
+};
+
+struct ShotChoice
+{
+	CVector3	aim;		// what ShootMarble is given
+	CVector3	forward;
+	CVector3	side;
+	int			value;		// the shooter's points
+	double		leave;		// how far from the middle the tolley stops
+	int			hits;
+	int			ringOuts;
+	bool		valid;		// false until a shot's been tried
+};
+
+class CShotSearch
+{
+public:
+	// 0 threads is one for every core
+	CShotSearch(int threads = 0);
+	~CShotSearch();
+
+	// the same numbers as the table has, or its snapshots won't fit
+	bool	CreateMarbles(int number, int tolleys = 1);
+	// starts looking for a shot by tolley on the table as it is, for
+	// budget seconds, in the background; one already going is cancelled
+	void	Begin(CMarbleSim& table, CTolley* tolley, double budget, unsigned int seed);
+	// true once the search is over and getBest has its shot; never waits
+	bool	Poll();
+	// waits for it to finish; Cancel has it stop after the shots it's
+	// playing out now, and keeps the best of what it's tried
+	void	Wait();
+	void	Cancel();
+
+	bool	isDone() { return m_done; }
+	const ShotChoice& getBest() { return m_best; }
+	int		getNumTried() { return m_tried; }
+	int		getNumThreads() { return m_searchers.size(); }
+	CShotCache& getCache() { return m_cache; }
+
+	static double getBudget(AILevel level);
+	static const char* getLevelName(AILevel level);
+
+private:
+	struct Searcher
+	{
+		CMarbleSim*		world;
+		CShotOutcome	outcome;
+		ShotResult		result;
+		unsigned int	seed;
+		ShotChoice		best;
+		int				tried;
+	};
+
+	static void SearchTask(void* data, int task);
+	// once the pool is done: the searchers' bests put together
+	void	Finish();
+	void	Search(Searcher& s);
+	void	Sample(Searcher& s, ShotChoice& shot);
+	void	Play(Searcher& s, ShotChoice& shot);
+	// fills in the rest of shot from what it did
+	static void Score(ShotChoice& shot, const ShotResult& result, unsigned int tolley);
+	// more points, or as many with the tolley left nearer the middle
+	static bool Better(const ShotChoice& a, const ShotChoice& b);
+
+	CWorkerPool		m_pool;
+	std::vector<Searcher> m_searchers;
+
+	// the table being searched
+	CSnapshot		m_table;
+	ShotKey			m_tableKey;
+	CShotCache		m_cache;
+	unsigned int	m_tolley;			// the shooter's handle
+	CVector3		m_tolleyPos;
+	std::vector<CVector3> m_targets;	// marbles still in play
+
+	double			m_deadline;
+	volatile long	m_stop;			// set to cut the search short
+	ShotChoice		m_best;
+	int				m_tried;
+	bool			m_done;
+};
+
+#endif
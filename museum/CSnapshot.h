@@ -0,0 +1,42 @@
+//-------------------------------------------------------------------
+//	CSnapshot
+//
+//	The table at one instant: a flat record per object, in the order
+//	of the manager's dense list, plus the few bits of world state a
+//	step depends on.  All plain data, so saving is a copy loop, and a
+//	snapshot kept around and saved into again doesn't allocate.
+//-------------------------------------------------------------------
+#ifndef CSNAPSHOT_H
+#define CSNAPSHOT_H
+
+#include "CCollisionEvents.h"
+
+#include <ode/ode.h>
+#include <vector>
+
+struct BodySnapshot
+{
+	unsigned int	handle;			// ObjectHandle
+	dReal			pos[3];
+	dQuaternion		q;
+	dReal			vel[3];
+	dReal			ang[3];
+	double			color[4];		// ring-outs are recoloured
+	double			stillTime;
+	unsigned char	enabled;
+	unsigned char	inPlay;
+};
+
+class CSnapshot
+{
+public:
+	std::vector<BodySnapshot>	bodies;		// awake first, as in the dense list
+	std::vector<TouchingPair>	touching;	// pairs in contact after the last step
+	std::vector<unsigned int>	geomOrder;	// handles in the order the awake space
+	int							numAwakeGeoms;	// has its geoms, then the sleep space's
+	double						simTime;
+	double						stepSize;
+	int							step;		// collision event step counter
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "CSphereNarrowphase.h"
+
+#include <cmath>
+#include <cstring>
+
+// dReal is double unless ODE was built single precision, so a vector
+// holds 2 pairs with SSE2 and 4 with AVX
+#if !defined(dSINGLE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define NARROWPHASE_SSE2
+#include <emmintrin.h>
+#endif
+#if !defined(dSINGLE) && defined(__AVX__)
+#define NARROWPHASE_AVX
+#include <immintrin.h>
+#endif
+
+CSphereNarrowphase::CSphereNarrowphase()
+{
+	Clear();
+}
+
+void CSphereNarrowphase::Clear()
+{
+	// clear() keeps the capacity, so after the first few steps
+	// none of this touches the heap
+	m_ssGeom1.clear(); m_ssGeom2.clear();
+	m_ax.clear(); m_ay.clear(); m_az.clear(); m_ar.clear();
+	m_bx.clear(); m_by.clear(); m_bz.clear(); m_br.clear();
+
+	m_spSphere.clear(); m_spPlane.clear(); m_spPlaneFirst.clear();
+	m_sx.clear(); m_sy.clear(); m_sz.clear(); m_sr.clear();
+	m_nx.clear(); m_ny.clear(); m_nz.clear(); m_nd.clear();
+
+	m_contacts.clear();
+}
+
+size_t CSphereNarrowphase::getCapacity()
+{
+	return m_ssGeom1.capacity() + m_ssGeom2.capacity() +
+		m_ax.capacity() + m_ay.capacity() + m_az.capacity() + m_ar.capacity() +
+		m_bx.capacity() + m_by.capacity() + m_bz.capacity() + m_br.capacity() +
+		m_spSphere.capacity() + m_spPlane.capacity() + m_spPlaneFirst.capacity() +
+		m_sx.capacity() + m_sy.capacity() + m_sz.capacity() + m_sr.capacity() +
+		m_nx.capacity() + m_ny.capacity() + m_nz.capacity() + m_nd.capacity() +
+		m_depth.capacity() + m_dist.capacity() +
+		m_normX.capacity() + m_normY.capacity() + m_normZ.capacity() +
+		m_posX.capacity() + m_posY.capacity() + m_posZ.capacity() +
+		m_contacts.capacity();
+}
+
+bool CSphereNarrowphase::AddPair(dGeomID o1, dGeomID o2)
+{
+	int c1 = dGeomGetClass(o1);
+	int c2 = dGeomGetClass(o2);
+
+	if (c1 == dSphereClass && c2 == dSphereClass) {
+		const dReal* p1 = dGeomGetPosition(o1);
+		const dReal* p2 = dGeomGetPosition(o2);
+		m_ssGeom1.push_back(o1);
+		m_ssGeom2.push_back(o2);
+		m_ax.push_back(p1[0]); m_ay.push_back(p1[1]); m_az.push_back(p1[2]);
+		m_ar.push_back(dGeomSphereGetRadius(o1));
+		m_bx.push_back(p2[0]); m_by.push_back(p2[1]); m_bz.push_back(p2[2]);
+		m_br.push_back(dGeomSphereGetRadius(o2));
+		return true;
+	}
+
+	bool planeFirst = (c1 == dPlaneClass && c2 == dSphereClass);
+	if (planeFirst || (c1 == dSphereClass && c2 == dPlaneClass)) {
+		dGeomID sphere = planeFirst ? o2 : o1;
+		dGeomID plane  = planeFirst ? o1 : o2;
+		const dReal* p = dGeomGetPosition(sphere);
+		dVector4 params;
+		dGeomPlaneGetParams(plane, params);
+		m_spSphere.push_back(sphere);
+		m_spPlane.push_back(plane);
+		m_spPlaneFirst.push_back(planeFirst);
+		m_sx.push_back(p[0]); m_sy.push_back(p[1]); m_sz.push_back(p[2]);
+		m_sr.push_back(dGeomSphereGetRadius(sphere));
+		m_nx.push_back(params[0]); m_ny.push_back(params[1]); m_nz.push_back(params[2]);
+		m_nd.push_back(params[3]);
+		return true;
+	}
+
+	return false;
+}
+
+void CSphereNarrowphase::ResizeOutput(int size)
+{
+	if ((int)m_depth.size() >= size) return;
+	m_depth.resize(size); m_dist.resize(size);
+	m_normX.resize(size); m_normY.resize(size); m_normZ.resize(size);
+	m_posX.resize(size);  m_posY.resize(size);  m_posZ.resize(size);
+}
+
+//-------------------------------------------------------------------
+//	Run the kernels, then pack the pairs that touch into contacts
+//-------------------------------------------------------------------
+
+int CSphereNarrowphase::Collide()
+{
+	Prepare();
+	Solve(0, getNumPairs());
+	return Pack();
+}
+
+void CSphereNarrowphase::Prepare()
+{
+	ResizeOutput(getNumPairs());
+}
+
+// sphere/sphere pairs come first, then sphere/plane
+void CSphereNarrowphase::Solve(int begin, int end)
+{
+	int numSS = m_ssGeom1.size();
+	if (begin < numSS)
+		SphereSphere(begin, (end < numSS) ? end : numSS);
+	if (end > numSS)
+		SpherePlane((begin > numSS) ? begin - numSS : 0, end - numSS);
+}
+
+int CSphereNarrowphase::Pack()
+{
+	int numSS = m_ssGeom1.size();
+	int numSP = m_spSphere.size();
+
+	dContactGeom c;
+	memset(&c, 0, sizeof(c));
+	for (int i = 0; i < numSS; i++) {
+		if (m_depth[i] < 0) continue;
+		c.g1 = m_ssGeom1[i];
+		c.g2 = m_ssGeom2[i];
+		c.depth = m_depth[i];
+		if (m_dist[i] <= 0) {
+			// dead centre, same fallback as dCollideSpheres
+			c.pos[0] = m_ax[i]; c.pos[1] = m_ay[i]; c.pos[2] = m_az[i];
+			c.normal[0] = 1; c.normal[1] = 0; c.normal[2] = 0;
+		} else {
+			c.pos[0] = m_posX[i]; c.pos[1] = m_posY[i]; c.pos[2] = m_posZ[i];
+			c.normal[0] = m_normX[i]; c.normal[1] = m_normY[i]; c.normal[2] = m_normZ[i];
+		}
+		m_contacts.push_back(c);
+	}
+
+	for (int i = 0; i < numSP; i++) {
+		int o = numSS + i;
+		if (m_depth[o] < 0) continue;
+		// dCollide flips the normal when the plane is the first geom
+		dReal sign = m_spPlaneFirst[i] ? -1 : 1;
+		c.g1 = m_spPlaneFirst[i] ? m_spPlane[i] : m_spSphere[i];
+		c.g2 = m_spPlaneFirst[i] ? m_spSphere[i] : m_spPlane[i];
+		c.depth = m_depth[o];
+		c.pos[0] = m_posX[o]; c.pos[1] = m_posY[o]; c.pos[2] = m_posZ[o];
+		c.normal[0] = sign*m_nx[i]; c.normal[1] = sign*m_ny[i]; c.normal[2] = sign*m_nz[i];
+		m_contacts.push_back(c);
+	}
+
+	return m_contacts.size();
+}
+
+//-------------------------------------------------------------------
+//	Sphere/sphere, same maths as ODE's dCollideSpheres:
+//		normal from b to a, depth ra+rb-d, point halfway into the overlap
+//-------------------------------------------------------------------
+
+void CSphereNarrowphase::SphereSphere(int i, int end)
+{
+	const dReal* ax = m_ax.empty() ? 0 : &m_ax[0];
+	const dReal* ay = m_ay.empty() ? 0 : &m_ay[0];
+	const dReal* az = m_az.empty() ? 0 : &m_az[0];
+	const dReal* ar = m_ar.empty() ? 0 : &m_ar[0];
+	const dReal* bx = m_bx.empty() ? 0 : &m_bx[0];
+	const dReal* by = m_by.empty() ? 0 : &m_by[0];
+	const dReal* bz = m_bz.empty() ? 0 : &m_bz[0];
+	const dReal* br = m_br.empty() ? 0 : &m_br[0];
+
+#ifdef NARROWPHASE_AVX
+	const __m256d zero4 = _mm256_setzero_pd();
+	const __m256d one4  = _mm256_set1_pd(1.0);
+	const __m256d half4 = _mm256_set1_pd(0.5);
+	for (; i + 4 <= end; i += 4) {
+		__m256d pax = _mm256_loadu_pd(ax+i), pay = _mm256_loadu_pd(ay+i), paz = _mm256_loadu_pd(az+i);
+		__m256d ra  = _mm256_loadu_pd(ar+i), rb  = _mm256_loadu_pd(br+i);
+		__m256d dx = _mm256_sub_pd(pax, _mm256_loadu_pd(bx+i));
+		__m256d dy = _mm256_sub_pd(pay, _mm256_loadu_pd(by+i));
+		__m256d dz = _mm256_sub_pd(paz, _mm256_loadu_pd(bz+i));
+		__m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx,dx), _mm256_mul_pd(dy,dy)), _mm256_mul_pd(dz,dz));
+		__m256d d  = _mm256_sqrt_pd(d2);
+		__m256d inv = _mm256_and_pd(_mm256_div_pd(one4, d), _mm256_cmp_pd(d, zero4, _CMP_GT_OQ));
+		__m256d nx = _mm256_mul_pd(dx, inv), ny = _mm256_mul_pd(dy, inv), nz = _mm256_mul_pd(dz, inv);
+		__m256d k  = _mm256_mul_pd(half4, _mm256_sub_pd(_mm256_sub_pd(rb, ra), d));
+		_mm256_storeu_pd(&m_depth[i], _mm256_sub_pd(_mm256_add_pd(ra, rb), d));
+		_mm256_storeu_pd(&m_dist[i], d);
+		_mm256_storeu_pd(&m_normX[i], nx);
+		_mm256_storeu_pd(&m_normY[i], ny);
+		_mm256_storeu_pd(&m_normZ[i], nz);
+		_mm256_storeu_pd(&m_posX[i], _mm256_add_pd(pax, _mm256_mul_pd(nx, k)));
+		_mm256_storeu_pd(&m_posY[i], _mm256_add_pd(pay, _mm256_mul_pd(ny, k)));
+		_mm256_storeu_pd(&m_posZ[i], _mm256_add_pd(paz, _mm256_mul_pd(nz, k)));
+	}
+#endif
+
+#ifdef NARROWPHASE_SSE2
+	const __m128d zero2 = _mm_setzero_pd();
+	const __m128d one2  = _mm_set1_pd(1.0);
+	const __m128d half2 = _mm_set1_pd(0.5);
+	for (; i + 2 <= end; i += 2) {
+		__m128d pax = _mm_loadu_pd(ax+i), pay = _mm_loadu_pd(ay+i), paz = _mm_loadu_pd(az+i);
+		__m128d ra  = _mm_loadu_pd(ar+i), rb  = _mm_loadu_pd(br+i);
+		__m128d dx = _mm_sub_pd(pax, _mm_loadu_pd(bx+i));
+		__m128d dy = _mm_sub_pd(pay, _mm_loadu_pd(by+i));
+		__m128d dz = _mm_sub_pd(paz, _mm_loadu_pd(bz+i));
+		__m128d d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx,dx), _mm_mul_pd(dy,dy)), _mm_mul_pd(dz,dz));
+		__m128d d  = _mm_sqrt_pd(d2);
+		__m128d inv = _mm_and_pd(_mm_div_pd(one2, d), _mm_cmpgt_pd(d, zero2));
+		__m128d nx = _mm_mul_pd(dx, inv), ny = _mm_mul_pd(dy, inv), nz = _mm_mul_pd(dz, inv);
+		__m128d k  = _mm_mul_pd(half2, _mm_sub_pd(_mm_sub_pd(rb, ra), d));
+		_mm_storeu_pd(&m_depth[i], _mm_sub_pd(_mm_add_pd(ra, rb), d));
+		_mm_storeu_pd(&m_dist[i], d);
+		_mm_storeu_pd(&m_normX[i], nx);
+		_mm_storeu_pd(&m_normY[i], ny);
+		_mm_storeu_pd(&m_normZ[i], nz);
+		_mm_storeu_pd(&m_posX[i], _mm_add_pd(pax, _mm_mul_pd(nx, k)));
+		_mm_storeu_pd(&m_posY[i], _mm_add_pd(pay, _mm_mul_pd(ny, k)));
+		_mm_storeu_pd(&m_posZ[i], _mm_add_pd(paz, _mm_mul_pd(nz, k)));
+	}
+#endif
+
+	for (; i < end; i++) {
+		dReal dx = ax[i] - bx[i];
+		dReal dy = ay[i] - by[i];
+		dReal dz = az[i] - bz[i];
+		dReal d = sqrt(dx*dx + dy*dy + dz*dz);
+		dReal inv = (d > 0) ? 1/d : 0;
+		dReal k = 0.5*(br[i] - ar[i] - d);
+		m_depth[i] = ar[i] + br[i] - d;
+		m_dist[i] = d;
+		m_normX[i] = dx*inv; m_normY[i] = dy*inv; m_normZ[i] = dz*inv;
+		m_posX[i] = ax[i] + m_normX[i]*k;
+		m_posY[i] = ay[i] + m_normY[i]*k;
+		m_posZ[i] = az[i] + m_normZ[i]*k;
+	}
+}
+
+//-------------------------------------------------------------------
+//	Sphere/plane, same maths as ODE's dCollideSpherePlane:
+//		depth d - n.p + r, point on the sphere's deepest spot
+//-------------------------------------------------------------------
+
+void CSphereNarrowphase::SpherePlane(int i, int end)
+{
+	if (i >= end) return;
+
+	int base = m_ssGeom1.size();
+	const dReal* sx = &m_sx[0];
+	const dReal* sy = &m_sy[0];
+	const dReal* sz = &m_sz[0];
+	const dReal* sr = &m_sr[0];
+	const dReal* nx = &m_nx[0];
+	const dReal* ny = &m_ny[0];
+	const dReal* nz = &m_nz[0];
+	const dReal* nd = &m_nd[0];
+	dReal* depth = &m_depth[base];
+	dReal* posX = &m_posX[base];
+	dReal* posY = &m_posY[base];
+	dReal* posZ = &m_posZ[base];
+
+#ifdef NARROWPHASE_AVX
+	for (; i + 4 <= end; i += 4) {
+		__m256d px = _mm256_loadu_pd(sx+i), py = _mm256_loadu_pd(sy+i), pz = _mm256_loadu_pd(sz+i);
+		__m256d r  = _mm256_loadu_pd(sr+i);
+		__m256d vx = _mm256_loadu_pd(nx+i), vy = _mm256_loadu_pd(ny+i), vz = _mm256_loadu_pd(nz+i);
+		__m256d k = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx,px), _mm256_mul_pd(vy,py)), _mm256_mul_pd(vz,pz));
+		_mm256_storeu_pd(depth+i, _mm256_add_pd(_mm256_sub_pd(_mm256_loadu_pd(nd+i), k), r));
+		_mm256_storeu_pd(posX+i, _mm256_sub_pd(px, _mm256_mul_pd(vx, r)));
+		_mm256_storeu_pd(posY+i, _mm256_sub_pd(py, _mm256_mul_pd(vy, r)));
+		_mm256_storeu_pd(posZ+i, _mm256_sub_pd(pz, _mm256_mul_pd(vz, r)));
+	}
+#endif
+
+#ifdef NARROWPHASE_SSE2
+	for (; i + 2 <= end; i += 2) {
+		__m128d px = _mm_loadu_pd(sx+i), py = _mm_loadu_pd(sy+i), pz = _mm_loadu_pd(sz+i);
+		__m128d r  = _mm_loadu_pd(sr+i);
+		__m128d vx = _mm_loadu_pd(nx+i), vy = _mm_loadu_pd(ny+i), vz = _mm_loadu_pd(nz+i);
+		__m128d k = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx,px), _mm_mul_pd(vy,py)), _mm_mul_pd(vz,pz));
+		_mm_storeu_pd(depth+i, _mm_add_pd(_mm_sub_pd(_mm_loadu_pd(nd+i), k), r));
+		_mm_storeu_pd(posX+i, _mm_sub_pd(px, _mm_mul_pd(vx, r)));
+		_mm_storeu_pd(posY+i, _mm_sub_pd(py, _mm_mul_pd(vy, r)));
+		_mm_storeu_pd(posZ+i, _mm_sub_pd(pz, _mm_mul_pd(vz, r)));
+	}
+#endif
+
+	for (; i < end; i++) {
+		dReal k = nx[i]*sx[i] + ny[i]*sy[i] + nz[i]*sz[i];
+		depth[i] = nd[i] - k + sr[i];
+		posX[i] = sx[i] - nx[i]*sr[i];
+		posY[i] = sy[i] - ny[i]*sr[i];
+		posZ[i] = sz[i] - nz[i]*sr[i];
+	}
+}
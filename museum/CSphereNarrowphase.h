@@ -0,0 +1,69 @@
+//-------------------------------------------------------------------
+//	CSphereNarrowphase
+//
+//	Nearly every pair the broadphase hands us is marble/marble or
+//	marble/floor, and dCollide's generic dispatch is a lot of work for
+//	that.  Those pairs get queued here in SoA arrays and solved in one
+//	pass, several at a time with SSE2/AVX, after the broadphase is
+//	done.  Anything else still goes through dCollide.
+//-------------------------------------------------------------------
+#ifndef CSPHERE_NARROWPHASE_H
+#define CSPHERE_NARROWPHASE_H
+
+#include <ode/ode.h>
+#include <vector>
+
+class CSphereNarrowphase
+{
+public:
+	CSphereNarrowphase();
+
+	void	Clear();
+
+	// queues the pair if it's sphere/sphere or sphere/plane,
+	// returns false if dCollide has to deal with it
+	bool	AddPair(dGeomID o1, dGeomID o2);
+
+	// solves everything queued, returns the number of contacts;
+	// each has g1/g2 in the order the pair was added, like dCollide
+	int		Collide();
+
+	// Collide in pieces, so Solve can be shared out between threads:
+	// Prepare, then Solve any split of [0, getNumPairs()), then Pack
+	int		getNumPairs() { return m_ssGeom1.size() + m_spSphere.size(); }
+	void	Prepare();
+	void	Solve(int begin, int end);
+	int		Pack();
+
+	int					getNumContacts() { return m_contacts.size(); }
+	const dContactGeom&	getContact(int i) { return m_contacts[i]; }
+
+	// every buffer's capacity added up; it only goes up, and only when
+	// something went to the heap
+	size_t	getCapacity();
+
+private:
+	void	SphereSphere(int begin, int end);
+	void	SpherePlane(int begin, int end);
+	void	ResizeOutput(int size);
+
+	// sphere/sphere pairs
+	std::vector<dGeomID>	m_ssGeom1, m_ssGeom2;
+	std::vector<dReal>		m_ax, m_ay, m_az, m_ar;
+	std::vector<dReal>		m_bx, m_by, m_bz, m_br;
+
+	// sphere/plane pairs, plane as n.p = d
+	std::vector<dGeomID>	m_spSphere, m_spPlane;
+	std::vector<char>		m_spPlaneFirst;
+	std::vector<dReal>		m_sx, m_sy, m_sz, m_sr;
+	std::vector<dReal>		m_nx, m_ny, m_nz, m_nd;
+
+	// results, sphere/sphere first then sphere/plane
+	std::vector<dReal>		m_depth, m_dist;
+	std::vector<dReal>		m_normX, m_normY, m_normZ;
+	std::vector<dReal>		m_posX, m_posY, m_posZ;
+
+	std::vector<dContactGeom> m_contacts;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include "CStateHash.h"
+#include "CObjectManager.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STATE_HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+#define HASH_PRIME	0x9e3779b1u
+#define HASH_WORDS	32		// a body's 13 dReals, padded out to 16 doubles
+
+// murmur3's finaliser, to spread a body's hash before it's added in
+unsigned int CStateHash::Mix(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+#ifdef STATE_HASH_SSE2
+// SSE2 has no 32 bit multiply keeping the low halves, so two 32x32->64s
+static inline __m128i MulLo32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+							  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+#endif
+
+// four lanes, each taking every fourth word: lane = (lane ^ w)*prime,
+// then a shift to fold the high bits back down
+unsigned int CStateHash::HashBody(dBodyID body)
+{
+	double words[HASH_WORDS/2];
+	memset(words, 0, sizeof(words));
+	const dReal* pos = dBodyGetPosition(body);
+	const dReal* q = dBodyGetQuaternion(body);
+	const dReal* vel = dBodyGetLinearVel(body);
+	const dReal* ang = dBodyGetAngularVel(body);
+	int i;
+	for (i = 0; i < 3; i++) {
+		words[i] = pos[i];
+		words[7+i] = vel[i];
+		words[10+i] = ang[i];
+	}
+	for (i = 0; i < 4; i++)
+		words[3+i] = q[i];
+
+	unsigned int lanes[4];
+#ifdef STATE_HASH_SSE2
+	const __m128i prime = _mm_set1_epi32((int)HASH_PRIME);
+	__m128i h = _mm_set_epi32(4, 3, 2, 1);
+	for (i = 0; i < HASH_WORDS/4; i++) {
+		__m128i w = _mm_loadu_si128((const __m128i*)words + i);
+		h = MulLo32(_mm_xor_si128(h, w), prime);
+		h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+	}
+	_mm_storeu_si128((__m128i*)lanes, h);
+#else
+	unsigned int w[HASH_WORDS];
+	memcpy(w, words, sizeof(w));
+	for (i = 0; i < 4; i++)
+		lanes[i] = i + 1;
+	for (i = 0; i < HASH_WORDS; i += 4)
+		for (int j = 0; j < 4; j++) {
+			lanes[j] = (lanes[j] ^ w[i+j])*HASH_PRIME;
+			lanes[j] ^= lanes[j] >> 15;
+		}
+#endif
+	return Mix(lanes[0] ^ Mix(lanes[1] ^ Mix(lanes[2] ^ Mix(lanes[3]))));
+}
+
+//-------------------------------------------------------------------
+//	Per step
+//-------------------------------------------------------------------
+
+CStateHash::CStateHash()
+{
+	m_file = 0;
+	m_detail = false;
+	m_hash = 0;
+}
+
+CStateHash::~CStateHash()
+{
+	Close();
+}
+
+bool CStateHash::Open(const char* fileName, bool detail)
+{
+	Close();
+	m_file = fopen(fileName, "wb");
+	if (!m_file) return false;
+	m_detail = detail;
+	StateHashHeader h;
+	h.magic = STATE_HASH_MAGIC;
+	h.version = STATE_HASH_VERSION;
+	h.detail = detail;
+	fwrite(&h, sizeof(h), 1, m_file);
+	return true;
+}
+
+void CStateHash::Close()
+{
+	if (m_file) fclose(m_file);
+	m_file = 0;
+}
+
+unsigned int CStateHash::Hash(CObjectManager& om, int end, int step)
+{
+	CObjectState& s = om.getState();
+	bool detail = m_file && m_detail;
+	if (detail) m_bodies.resize(end);
+
+	// a sum, so the objects can come in any order
+	unsigned int hash = 0;
+	for (int i = 0; i < end; i++) {
+		unsigned int handle = (unsigned int)(size_t)dBodyGetData(s.body[i]);
+		unsigned int body = HashBody(s.body[i]);
+		hash += Mix(body ^ handle*HASH_PRIME);
+		if (detail) {
+			m_bodies[i].handle = handle;
+			m_bodies[i].hash = body;
+		}
+	}
+	m_hash = hash;
+
+	if (m_file) {
+		StepHashRecord r;
+		r.step = step;
+		r.numBodies = end;
+		r.hash = hash;
+		fwrite(&r, sizeof(r), 1, m_file);
+		if (detail && end)
+			fwrite(&m_bodies[0], sizeof(BodyHashRecord), end, m_file);
+	}
+	return hash;
+}
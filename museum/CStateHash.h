@@ -0,0 +1,75 @@
+//-------------------------------------------------------------------
+//	CStateHash
+//
+//	A hash of the world after every step, to prove two runs (thread
+//	counts, broadphases, builds, a replay) did exactly the same thing.
+//	Each body that moved in the step hashes its position, rotation
+//	and velocities bit for bit; the step's hash adds those up keyed
+//	by handle, so it doesn't care what order the objects are in.
+//	Sleepers don't change and aren't hashed, so it costs no more
+//	than the awake bodies.
+//
+//	With a file open every step's hash is logged to it, optionally
+//	with each body's hash so hash_compare can name the first one to
+//	go wrong.  The SSE2 and plain versions give the same hashes.
+//-------------------------------------------------------------------
+#ifndef CSTATE_HASH_H
+#define CSTATE_HASH_H
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <vector>
+
+#define STATE_HASH_MAGIC	0x4853484d		// "MHSH"
+#define STATE_HASH_VERSION	1
+
+class CObjectManager;
+
+// what the log holds: a header, then per step a StepHashRecord and,
+// with detail, numBodies BodyHashRecords
+struct StateHashHeader
+{
+	unsigned int	magic;
+	unsigned int	version;
+	unsigned int	detail;
+};
+
+struct StepHashRecord
+{
+	int				step;
+	int				numBodies;
+	unsigned int	hash;
+};
+
+struct BodyHashRecord
+{
+	unsigned int	handle;
+	unsigned int	hash;
+};
+
+class CStateHash
+{
+public:
+	CStateHash();
+	~CStateHash();
+
+	bool	Open(const char* fileName, bool detail);
+	void	Close();
+	bool	isOpen() { return m_file != 0; }
+
+	// hashes objects [0, end) of the manager and logs the step
+	unsigned int Hash(CObjectManager& om, int end, int step);
+	unsigned int getHash() { return m_hash; }		// the last step's
+
+	static unsigned int HashBody(dBodyID body);
+	// murmur3's finaliser, for anyone else hashing a few words
+	static unsigned int Mix(unsigned int h);
+
+private:
+	FILE*	m_file;
+	bool	m_detail;
+	unsigned int m_hash;
+	std::vector<BodyHashRecord> m_bodies;
+};
+
+#endif
@@ -0,0 +1,260 @@
+#include "CThreads.h"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+int GetNumCores()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int cores = info.dwNumberOfProcessors;
+#else
+	int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return (cores > 0) ? cores : 1;
+}
+
+#ifdef _WIN32
+
+long AtomicIncrement(volatile long* value)
+{
+	return InterlockedIncrement((LONG*)value);
+}
+
+long AtomicCompareExchange(volatile long* value, long exchange, long comparand)
+{
+	return InterlockedCompareExchange((LONG*)value, exchange, comparand);
+}
+
+void MemoryFence()
+{
+	LONG fence = 0;
+	InterlockedExchange(&fence, 0);
+}
+
+#else
+
+long AtomicIncrement(volatile long* value)
+{
+	return __sync_add_and_fetch(value, 1);
+}
+
+long AtomicCompareExchange(volatile long* value, long exchange, long comparand)
+{
+	return __sync_val_compare_and_swap(value, comparand, exchange);
+}
+
+void MemoryFence()
+{
+	__sync_synchronize();
+}
+
+#endif
+
+#ifdef _WIN32
+
+CMutex::CMutex()		{ InitializeCriticalSection(&m_section); }
+CMutex::~CMutex()		{ DeleteCriticalSection(&m_section); }
+void CMutex::Lock()		{ EnterCriticalSection(&m_section); }
+void CMutex::Unlock()	{ LeaveCriticalSection(&m_section); }
+
+#else
+
+CMutex::CMutex()		{ pthread_mutex_init(&m_mutex, 0); }
+CMutex::~CMutex()		{ pthread_mutex_destroy(&m_mutex); }
+void CMutex::Lock()		{ pthread_mutex_lock(&m_mutex); }
+void CMutex::Unlock()	{ pthread_mutex_unlock(&m_mutex); }
+
+#endif
+
+//-------------------------------------------------------------------
+//	CWorkerPool
+//-------------------------------------------------------------------
+
+CWorkerPool::CWorkerPool(int threads, ThreadHook start, ThreadHook finish)
+{
+	m_numWorkers = (threads > 1) ? threads - 1 : 0;
+	m_workers = new Worker[m_numWorkers + 1];
+	m_start = start;
+	m_finish = finish;
+	m_work = 0;
+	m_data = 0;
+	m_numTasks = m_nextTask = m_doneTasks = 0;
+	m_generation = 0;
+	m_quit = false;
+
+#ifdef _WIN32
+	m_finished = CreateEvent(0, FALSE, FALSE, 0);
+#else
+	pthread_cond_init(&m_wake, 0);
+	pthread_cond_init(&m_finished, 0);
+#endif
+	for (int i = 0; i < m_numWorkers; i++) {
+		Worker& w = m_workers[i];
+		w.pool = this;
+		w.index = i;
+#ifdef _WIN32
+		w.wake = CreateEvent(0, FALSE, FALSE, 0);
+		w.thread = (HANDLE)_beginthreadex(0, 0, &CWorkerPool::ThreadMain, &w, 0, 0);
+#else
+		pthread_create(&w.thread, 0, &CWorkerPool::ThreadMain, &w);
+#endif
+	}
+}
+
+CWorkerPool::~CWorkerPool()
+{
+	int i;
+#ifdef _WIN32
+	m_lock.Lock();
+	m_quit = true;
+	m_lock.Unlock();
+	for (i = 0; i < m_numWorkers; i++)
+		SetEvent(m_workers[i].wake);
+	for (i = 0; i < m_numWorkers; i++) {
+		WaitForSingleObject(m_workers[i].thread, INFINITE);
+		CloseHandle(m_workers[i].thread);
+		CloseHandle(m_workers[i].wake);
+	}
+	CloseHandle(m_finished);
+#else
+	pthread_mutex_lock(&m_lock.m_mutex);
+	m_quit = true;
+	pthread_cond_broadcast(&m_wake);
+	pthread_mutex_unlock(&m_lock.m_mutex);
+	for (i = 0; i < m_numWorkers; i++)
+		pthread_join(m_workers[i].thread, 0);
+	pthread_cond_destroy(&m_wake);
+	pthread_cond_destroy(&m_finished);
+#endif
+	delete [] m_workers;
+}
+
+#ifdef _WIN32
+unsigned __stdcall CWorkerPool::ThreadMain(void* worker)
+#else
+void* CWorkerPool::ThreadMain(void* worker)
+#endif
+{
+	Worker* w = (Worker*)worker;
+	CWorkerPool* pool = w->pool;
+	if (pool->m_start) pool->m_start();
+	pool->WorkerLoop(*w);
+	if (pool->m_finish) pool->m_finish();
+	return 0;
+}
+
+void CWorkerPool::WorkerLoop(Worker& me)
+{
+	int seen = 0;
+	for (;;) {
+#ifdef _WIN32
+		WaitForSingleObject(me.wake, INFINITE);
+		m_lock.Lock();
+#else
+		pthread_mutex_lock(&m_lock.m_mutex);
+		while (!m_quit && m_generation == seen)
+			pthread_cond_wait(&m_wake, &m_lock.m_mutex);
+#endif
+		bool quit = m_quit;
+		seen = m_generation;
+		m_lock.Unlock();
+		if (quit) return;
+		DoTasks();
+	}
+}
+
+bool CWorkerPool::DoTasks()
+{
+	for (;;) {
+		m_lock.Lock();
+		int task = m_nextTask++;
+		WorkFunction work = m_work;
+		void* data = m_data;
+		m_lock.Unlock();
+		if (task >= m_numTasks) return false;
+
+		work(data, task);
+
+		m_lock.Lock();
+		bool last = (++m_doneTasks == m_numTasks);
+#ifdef _WIN32
+		if (last) SetEvent(m_finished);
+#else
+		if (last) pthread_cond_signal(&m_finished);
+#endif
+		m_lock.Unlock();
+		if (last) return true;
+	}
+}
+
+void CWorkerPool::Launch(WorkFunction work, void* data, int numTasks, int helpers)
+{
+	m_lock.Lock();
+	m_work = work;
+	m_data = data;
+	m_numTasks = numTasks;
+	m_nextTask = 0;
+	m_doneTasks = 0;
+	m_generation++;
+#ifdef _WIN32
+	// a job that was only polled till it finished left it set
+	ResetEvent(m_finished);
+#endif
+	m_lock.Unlock();
+
+	// no point waking more workers than there are tasks for them
+	int wake = (helpers < m_numWorkers) ? helpers : m_numWorkers;
+#ifdef _WIN32
+	for (int i = 0; i < wake; i++)
+		SetEvent(m_workers[i].wake);
+#else
+	if (wake > 0) {
+		pthread_mutex_lock(&m_lock.m_mutex);
+		pthread_cond_broadcast(&m_wake);
+		pthread_mutex_unlock(&m_lock.m_mutex);
+	}
+#endif
+}
+
+void CWorkerPool::Run(WorkFunction work, void* data, int numTasks)
+{
+	if (numTasks <= 0) return;
+	Launch(work, data, numTasks, numTasks - 1);
+	DoTasks();
+	Wait();
+}
+
+void CWorkerPool::Start(WorkFunction work, void* data, int numTasks)
+{
+	if (numTasks <= 0) return;
+	Launch(work, data, numTasks, numTasks);
+	if (!m_numWorkers)
+		DoTasks();
+}
+
+bool CWorkerPool::isFinished()
+{
+	CLock lock(m_lock);
+	return m_doneTasks >= m_numTasks;
+}
+
+// whoever finishes the last task sets m_finished, even if it's us
+void CWorkerPool::Wait()
+{
+#ifdef _WIN32
+	for (;;) {
+		if (isFinished()) return;
+		WaitForSingleObject(m_finished, INFINITE);
+	}
+#else
+	pthread_mutex_lock(&m_lock.m_mutex);
+	while (m_doneTasks < m_numTasks)
+		pthread_cond_wait(&m_finished, &m_lock.m_mutex);
+	pthread_mutex_unlock(&m_lock.m_mutex);
+#endif
+}
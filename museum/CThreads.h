@@ -0,0 +1,150 @@
+//-------------------------------------------------------------------
+//	CThreads
+//
+//	The little bit of threading the simulation needs, over Win32 or
+//	pthreads: a mutex and a pool of workers that share out numbered
+//	tasks.
+//-------------------------------------------------------------------
+#ifndef CTHREADS_H
+#define CTHREADS_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// a static each thread has its own copy of; plain data only
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// how many cores we can run on, at least 1
+int GetNumCores();
+
+// atomic operations on a long, each a full memory barrier.
+// AtomicIncrement returns the new value, AtomicCompareExchange the
+// old one (it only wrote if that was comparand).
+long AtomicIncrement(volatile long* value);
+long AtomicCompareExchange(volatile long* value, long exchange, long comparand);
+// no reads or writes move across this
+void MemoryFence();
+
+class CMutex
+{
+public:
+	CMutex();
+	~CMutex();
+
+	void	Lock();
+	void	Unlock();
+
+private:
+	friend class CWorkerPool;		// waits on the pthread mutex
+	CMutex(const CMutex&);
+	CMutex& operator=(const CMutex&);
+
+#ifdef _WIN32
+	CRITICAL_SECTION	m_section;
+#else
+	pthread_mutex_t		m_mutex;
+#endif
+};
+
+// holds a CMutex for as long as it's in scope
+class CLock
+{
+public:
+	CLock(CMutex& mutex) : m_mutex(mutex) { m_mutex.Lock(); }
+	~CLock() { m_mutex.Unlock(); }
+
+private:
+	CLock(const CLock&);
+	CLock& operator=(const CLock&);
+
+	CMutex&	m_mutex;
+};
+
+// one numbered piece of a job; data is whatever Run was given
+typedef void (*WorkFunction)(void* data, int task);
+// run on each worker thread as it starts and before it exits
+typedef void (*ThreadHook)();
+
+//-------------------------------------------------------------------
+//	CWorkerPool
+//
+//	threads-1 workers plus whoever calls Run.  Tasks go to whichever
+//	thread asks first, so a job has to write each task's results
+//	somewhere of its own and put them together afterwards.
+//
+//	A job can also be left to the workers alone with Start, while the
+//	caller gets on with something else; it has to be waited for (or
+//	seen to be finished) before the next Run or Start.
+//-------------------------------------------------------------------
+class CWorkerPool
+{
+public:
+	CWorkerPool(int threads, ThreadHook start = 0, ThreadHook finish = 0);
+	~CWorkerPool();
+
+	// runs tasks [0, numTasks) and returns when they're all done
+	void	Run(WorkFunction work, void* data, int numTasks);
+	// the same on the workers only, returning at once; with no workers
+	// it runs them there and then
+	void	Start(WorkFunction work, void* data, int numTasks);
+	bool	isFinished();
+	void	Wait();
+	int		getNumThreads() { return m_numWorkers + 1; }
+
+private:
+	CWorkerPool(const CWorkerPool&);
+	CWorkerPool& operator=(const CWorkerPool&);
+
+	struct Worker
+	{
+		CWorkerPool*	pool;
+		int				index;
+#ifdef _WIN32
+		HANDLE			thread;
+		HANDLE			wake;		// auto-reset
+#else
+		pthread_t		thread;
+#endif
+	};
+
+#ifdef _WIN32
+	static unsigned __stdcall ThreadMain(void* worker);
+#else
+	static void* ThreadMain(void* worker);
+#endif
+	void	WorkerLoop(Worker& me);
+	// sets a job up and wakes up to helpers workers for it
+	void	Launch(WorkFunction work, void* data, int numTasks, int helpers);
+	// takes tasks until there are none left; true if it finished the job
+	bool	DoTasks();
+
+	int				m_numWorkers;
+	Worker*			m_workers;
+	ThreadHook		m_start;
+	ThreadHook		m_finish;
+
+	CMutex			m_lock;
+	WorkFunction	m_work;
+	void*			m_data;
+	int				m_numTasks;
+	int				m_nextTask;
+	int				m_doneTasks;
+	int				m_generation;	// bumped for every Run
+	bool			m_quit;
+
+#ifdef _WIN32
+	HANDLE			m_finished;		// set by whoever finishes the last task
+#else
+	pthread_cond_t	m_wake;
+	pthread_cond_t	m_finished;
+#endif
+};
+
+#endif
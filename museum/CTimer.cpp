@@ -1,14 +1,39 @@
 #include "CTimer.h"
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//------------------------------------------------------------------
+//	Raw tick counter; ticks per second is in m_frequency
+//------------------------------------------------------------------
+
+static TimerTick ReadTicks()
+{
+#ifdef _WIN32
+	LARGE_INTEGER temp;
+	QueryPerformanceCounter(&temp);
+	return temp.QuadPart;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (TimerTick)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
 
 CTimer::CTimer()
 {	
 	m_lastTime = 0;
 	m_totalTime = 0;
+#ifdef _WIN32
 	LARGE_INTEGER temp;
 	QueryPerformanceFrequency(&temp);
 	m_frequency = temp.QuadPart;
+#else
+	m_frequency = 1000000000;
+#endif
 }
 
 CTimer::~CTimer()
@@ -18,10 +43,8 @@ CTimer::~CTimer()
 
 void CTimer::FrameUpdate()
 {
-	LARGE_INTEGER temp;
-	QueryPerformanceCounter(&temp);
 	m_lastTime = m_totalTime;
-	m_totalTime = temp.QuadPart;
+	m_totalTime = ReadTicks();
 }
 
 double CTimer::getDeltaT() const
@@ -29,6 +52,17 @@ double CTimer::getDeltaT() const
 	return (double)(m_totalTime-m_lastTime)/(double)m_frequency;
 }
 
+double CTimer::getSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER temp;
+	QueryPerformanceFrequency(&temp);
+	return (double)ReadTicks()/(double)temp.QuadPart;
+#else
+	return (double)ReadTicks()/1e9;
+#endif
+}
+
 double CTimer::getTime() const
 {
 	return (double)m_totalTime/(double)m_frequency;
@@ -8,6 +8,12 @@
 
 #include "Singleton.h"
 
+#ifdef _WIN32
+typedef __int64 TimerTick;
+#else
+typedef long long TimerTick;
+#endif
+
 class CTimer: public Singleton<CTimer>
 {
 public:
@@ -20,10 +26,13 @@ public:
 	
 	void FrameUpdate ();
 
+	// a clock for timing things that doesn't disturb the frame timer
+	static double getSeconds();
+
 private:	
-	__int64 m_frequency;
-	__int64	m_lastTime;
-	__int64	m_totalTime;
+	TimerTick	m_frequency;
+	TimerTick	m_lastTime;
+	TimerTick	m_totalTime;
 };
 
 #endif
@@ -25,7 +25,7 @@ public:
 	
 	CVector3 operator= (CVector3 in);
 	double operator[] (int i);
-	void CVector3::set (double,double,double);
+	void set (double,double,double);
 	void Cross(CVector3 vVector1, CVector3 vVector2);
 
 	double Magnitude();
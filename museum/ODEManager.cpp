@@ -1,26 +1,144 @@
 #include "ODEManager.h"
 
-#include "CGame.h"
+#include "CMarbleSim.h"
 #include "CTimer.h"
-#include "SoundManager.h"
+#include "CObjectManager.h"
+#include "CMarble.h"
+#include "CSnapshot.h"
 
 #include <ode/ode.h>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 
-ODEManager::ODEManager()
+// a cell as wide as the biggest marble, so only neighbours can touch
+ODEManager::ODEManager(CMarbleSim& sim) : m_sim(sim), m_grid(2*TOLLEY_RADIUS)
 {
+	CContactArena::InstallAllocHooks();
 	m_world = dWorldCreate();
 	m_space = dHashSpaceCreate(0);
+	m_sleepSpace = dHashSpaceCreate(0);
+	m_staticSpace = dSimpleSpaceCreate(0);
 	
 	m_contactgroup = dJointGroupCreate(0);
 	setGravity(0.0f,-9.8f,0.0f);
 	dWorldSetCFM(m_world,1e-5);
 	
-	m_plane = dCreatePlane(m_space,0,1,0,0);
+	m_plane = dCreatePlane(m_staticSpace,0,1,0,0);
+	setGeomMaterial(m_plane, MAT_Felt);
+
+	m_stepSize = PHYSICS_STEP;
+	m_lastStepSize = PHYSICS_STEP;
+	m_maxSubSteps = MAX_SUBSTEPS;
+	m_adaptiveStep = false;
+	m_minStep = MIN_STEP;
+	m_maxStep = MAX_STEP;
+	m_simTime = 0;
+	m_stepRate = 0;
+	m_simStepRate = 0;
+	m_rateStart = CTimer::getSeconds();
+	m_rateSimStart = 0;
+	m_rateSteps = 0;
+	m_accumulator = 0;
+	m_interpAlpha = 1;
+	m_broadphase = BP_HashSpace;
+	for (int i = 0; i < BP_NumBroadphases; i++)
+		m_broadphaseTime[i] = 0;
+	m_stepAllocs = 0;
+	m_threads = 1;
+	m_pool = 0;
+	m_sphereTasks = 0;
+	m_genericTasks = 0;
+	m_sphereContacts = 0;
+	m_ccd = true;
+	m_ccdFast = 0;
+	m_ccdSubSteps = 0;
+#ifdef MARBLES_ODE_THREADS
+	m_threading = 0;
+	m_threadPool = 0;
+#endif
+	InitSurfaces();
 }
 
 ODEManager::~ODEManager()
 {
+	setThreadCount(1);
+	dJointGroupDestroy(m_contactgroup);
+	dSpaceDestroy(m_space);
+	dSpaceDestroy(m_sleepSpace);
+	dSpaceDestroy(m_staticSpace);
+	dWorldDestroy(m_world);
+}
+
+//-------------------------------------------------------------------
+//	Threads
+//
+//	Our pool shares out the narrowphase.  ODE already splits
+//	dWorldStep into islands, and given a threading implementation it
+//	solves them on a pool of its own; each island is solved on its
+//	own, so which thread gets which island doesn't change the answer.
+//-------------------------------------------------------------------
+
+// dCollide keeps per thread data in ODE 0.13 on
+void ODEManager::AttachThread()
+{
+#ifdef MARBLES_ODE_THREADS
+	dAllocateODEDataForThread(dAllocateMaskAll);
+#endif
+}
 
+void ODEManager::DetachThread()
+{
+#ifdef MARBLES_ODE_THREADS
+	dCleanupODEAllDataForThread();
+#endif
+	CContactArena::ReleaseThread();
+}
+
+int ODEManager::setThreadCount(int threads)
+{
+	if (threads < 1) threads = 1;
+	delete m_pool;
+	m_pool = 0;
+#ifdef MARBLES_ODE_THREADS
+	if (m_threading) {
+		dWorldSetStepThreadingImplementation(m_world, 0, 0);
+		dThreadingImplementationShutdownProcessing(m_threading);
+		dThreadingFreeThreadPool(m_threadPool);
+		dThreadingFreeImplementation(m_threading);
+		m_threading = 0;
+		m_threadPool = 0;
+	}
+#endif
+	m_threads = threads;
+	if (threads == 1) return 1;
+
+	m_pool = new CWorkerPool(threads, &ODEManager::AttachThread, &ODEManager::DetachThread);
+
+#ifdef MARBLES_ODE_THREADS
+	// 0 if ODE was built without its threading support
+	m_threading = dThreadingAllocateMultiThreadedImplementation();
+	if (!m_threading) return m_threads;
+	m_threadPool = dThreadingAllocateThreadPool(threads, 0, dAllocateFlagBasicData, 0);
+	if (!m_threadPool) {
+		dThreadingFreeImplementation(m_threading);
+		m_threading = 0;
+		return m_threads;
+	}
+	dThreadingThreadPoolServeMultiThreadedImplementation(m_threadPool, m_threading);
+	dWorldSetStepThreadingImplementation(m_world,
+		dThreadingImplementationGetFunctions(m_threading), m_threading);
+#endif
+	return m_threads;
+}
+
+bool ODEManager::isStepThreaded()
+{
+#ifdef MARBLES_ODE_THREADS
+	return m_threading != 0;
+#else
+	return false;
+#endif
 }
 
 //-------------------------------------------------------
@@ -39,18 +157,182 @@ void ODEManager::setViewPoint(double xyz[], double hpr[])
 
 //-------------------------------------------------------------------
 //	Sim Loop main loop!
+//
+//	Banks the frame time and runs as many fixed steps as fit in it,
+//	so the simulation runs at the same speed whatever the frame rate.
+//	Whatever is left over becomes the interpolation alpha for drawing.
+//-------------------------------------------------------------------
+
+void ODEManager::SimLoop(double deltaT, bool pause)
+{
+	if (pause) return;
+
+	m_accumulator += deltaT;
+
+	int steps = 0;
+	while (steps < m_maxSubSteps) {
+		if (m_adaptiveStep) m_stepSize = ChooseStepSize();
+		if (m_accumulator < m_stepSize) break;
+		Step();
+		m_accumulator -= m_stepSize;
+		steps++;
+	}
+
+	// we're too far behind to catch up (slow frame, breakpoint, first
+	// frame), so drop the backlog instead of spiralling into it
+	if (m_accumulator >= m_stepSize)
+		m_accumulator = fmod(m_accumulator, m_stepSize);
+
+	// how far into the step after the last one we are, in the last
+	// one's terms (the next can be longer, so it can't quite reach 1)
+	m_interpAlpha = m_accumulator / m_lastStepSize;
+	if (m_interpAlpha > 1) m_interpAlpha = 1;
+}
+
+//-------------------------------------------------------------------
+//	Headless stepping, as fast as we can go
 //-------------------------------------------------------------------
 
-void ODEManager::SimLoop(bool pause)
+void ODEManager::Advance(int steps)
 {
-	if (!pause) {
-		double deltaT = CTimer::Instance().getDeltaT();
-		dSpaceCollide (m_space,0,&ODEManager::StaticCallback);
-		dWorldStep (m_world,0.05);
+	for (int i = 0; i < steps; i++) {
+		if (m_adaptiveStep) m_stepSize = ChooseStepSize();
+		Step();
+	}
+	m_accumulator = 0;
+	m_interpAlpha = 1;
+}
 
-		/* remove all contact joints */
-		dJointGroupEmpty (m_contactgroup);
+//-------------------------------------------------------------------
+//	Advances the world by exactly one fixed step
+//-------------------------------------------------------------------
+
+void ODEManager::Step()
+{
+	CObjectManager& om = m_sim.getObjectManager();
+	int allocs = CContactArena::getHeapAllocs() + m_contacts.getNumGrows();
+	size_t capacity[STEP_BUFFERS];
+	GetStepCapacities(capacity);
+
+	// remember where everything was so Draw can blend toward the new state
+	om.StorePhysicsState();
+
+	m_narrowphase.Clear();
+	m_pairs.clear();
+	m_events.BeginStep();
+	m_contacts.Begin();
+
+	// ring exits
+	om.UpdateObjects();
+
+	if (m_ccd) SubStepFastBodies();
+
+	Broadphase();
+	Narrowphase();
+	m_contacts.Flush(m_world, m_contactgroup);
+
+	// no point waking more threads than there are islands to solve
+	m_islands.Build(m_contacts, om);
+#ifdef MARBLES_ODE_THREADS
+	if (m_threading) {
+		int threads = m_islands.getNumIslands();
+		if (threads > m_threads) threads = m_threads;
+		dWorldSetStepIslandsProcessingMaxThreadCount(m_world, (threads > 0) ? threads : 1);
 	}
+#endif
+	dWorldStep (m_world,m_stepSize);
+
+	/* remove all contact joints */
+	dJointGroupEmpty (m_contactgroup);
+	ReleaseSubStepped();
+
+	m_events.EndStep();
+	// the ones that fall asleep now end up just past the awake range
+	int moved = om.getNumActive();
+	om.UpdateSleep(m_stepSize);
+	m_stateHash.Hash(om, moved, getStepCount());
+	m_stepAllocs = CContactArena::getHeapAllocs() + m_contacts.getNumGrows() - allocs;
+	size_t after[STEP_BUFFERS];
+	GetStepCapacities(after);
+	for (int i = 0; i < STEP_BUFFERS; i++)
+		if (after[i] != capacity[i]) m_stepAllocs++;
+	m_lastStepSize = m_stepSize;
+	m_simTime += m_stepSize;
+	UpdateStepRate();
+
+	m_sim.DispatchEvents();
+}
+
+// none of these ever shrink, so a change over a step means at least
+// one of the group went to the heap
+void ODEManager::GetStepCapacities(size_t* capacity)
+{
+	capacity[0] = m_pairs.capacity() + m_pairContacts.capacity() + m_taskContacts.capacity() +
+		m_ccdGroup.capacity() + m_ccdFrozen.capacity() + m_ccdRadius.capacity();
+	for (unsigned int i = 0; i < m_taskContacts.size(); i++)
+		capacity[0] += m_taskContacts[i].capacity();
+	capacity[1] = m_narrowphase.getCapacity();
+	capacity[2] = m_grid.getCapacity();
+	capacity[3] = m_events.getCapacity();
+	capacity[4] = m_islands.getCapacity();
+}
+
+void ODEManager::setStepSize(double step)
+{
+	assert(step > 0);
+	m_stepSize = step;
+	m_accumulator = 0;
+}
+
+void ODEManager::setStepRange(double minStep, double maxStep)
+{
+	assert(minStep > 0 && minStep <= maxStep);
+	m_minStep = minStep;
+	m_maxStep = maxStep;
+}
+
+//-------------------------------------------------------------------
+//	Adaptive step
+//
+//	The step the fastest body (for its size) allows, so nothing moves
+//	more than STEP_CFL of its radius.  A still table gets the longest
+//	step in the range, which tops out at the fixed PHYSICS_STEP, so
+//	adapting only ever shortens it; anything too quick for the
+//	shortest is left to the continuous collision.
+//-------------------------------------------------------------------
+
+double ODEManager::ChooseStepSize()
+{
+	CObjectManager& om = m_sim.getObjectManager();
+	CObjectState& s = om.getState();
+	double step = m_maxStep;
+	for (int i = 0; i < om.getNumActive(); i++) {
+		const dReal* v = dBodyGetLinearVel(s.body[i]);
+		double speed = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+		if (speed*step > STEP_CFL*s.radius[i])
+			step = STEP_CFL*s.radius[i]/speed;
+	}
+	if (step < m_minStep) step = m_minStep;
+	return step;
+}
+
+void ODEManager::UpdateStepRate()
+{
+	m_rateSteps++;
+	double now = CTimer::getSeconds();
+	if (now - m_rateStart < STEP_RATE_WINDOW) return;
+
+	m_stepRate = m_rateSteps/(now - m_rateStart);
+	m_simStepRate = (m_simTime > m_rateSimStart) ? m_rateSteps/(m_simTime - m_rateSimStart) : 0;
+	m_rateStart = now;
+	m_rateSimStart = m_simTime;
+	m_rateSteps = 0;
+}
+
+void ODEManager::setMaxSubSteps(int steps)
+{
+	assert(steps > 0);
+	m_maxSubSteps = steps;
 }
 
 //-------------------------------------------------------------------
@@ -68,7 +350,9 @@ dBodyID ODEManager::createBody()
 
 dGeomID ODEManager::createSphere(double radius)
 {	
-	return dCreateSphere(m_space,radius);    
+	dGeomID geom = dCreateSphere(m_space,radius);
+	setGeomMaterial(geom, MAT_Clearie);
+	return geom;
 }
 
 
@@ -78,7 +362,7 @@ dGeomID ODEManager::createSphere(double radius)
 
 dGeomID	ODEManager::createPlane(dReal a, dReal b, dReal c, dReal d)
 {
-	return dCreatePlane(m_space,a,b,c,d);
+	return dCreatePlane(m_staticSpace,a,b,c,d);
 }
 
 //-------------------------------------------------------
@@ -87,7 +371,9 @@ dGeomID	ODEManager::createPlane(dReal a, dReal b, dReal c, dReal d)
 
 dGeomID ODEManager::createBox(double length, double width, double height)
 {
-	return dCreateBox(m_space, length, width, height);
+	dGeomID geom = dCreateBox(m_staticSpace, length, width, height);
+	setGeomMaterial(geom, MAT_Obstacle);
+	return geom;
 }
 
 
@@ -95,45 +381,589 @@ dGeomID ODEManager::createGeomTransform()
 {
 	return dCreateGeomTransform(m_space);
 }
+//-------------------------------------------------------------------
+//	Contact surfaces
+//
+//	Every pair of materials gets its dSurfaceParameters worked out
+//	once here; a contact just copies its pair's entry.  Nothing slides
+//	(mu is infinite), so marbles slow down through rolling friction in
+//	the solver: rho resists rolling, rhoN resists spinning on the
+//	spot.  The felt is smooth and the ground outside the ring is
+//	rough; the tolley is heavier going than a marble and a cat's eye
+//	is a touch lumpier than a clearie.
+//-------------------------------------------------------------------
+
+void ODEManager::InitSurfaces()
+{
+	dSurfaceParameters base;
+	memset(&base, 0, sizeof(base));
+	base.mode = dContactBounce | dContactApprox1; // | dContactSoftCFM;
+	base.mu = dInfinity;
+	base.mu2 = dInfinity;
+	base.bounce = 0.75f;
+	base.bounce_vel = 0.1;
+	//base.soft_cfm = 0.01;
+
+	int i, j;
+	for (i = 0; i < MAT_NumMaterials; i++)
+		for (j = 0; j < MAT_NumMaterials; j++)
+			m_surfaces[i][j] = base;
+
+	// obstacles are wood, they don't give the marbles much back
+	for (i = 0; i < MAT_NumMaterials; i++)
+		m_surfaces[i][MAT_Obstacle].bounce = m_surfaces[MAT_Obstacle][i].bounce = 0.4f;
+
+	static const struct {
+		SurfaceMaterial	ball, floor;
+		dReal			rho, rhoN;
+	} rolling[] = {
+		{ MAT_Clearie, MAT_Felt,	0.02,	0.02 },
+		{ MAT_Clearie, MAT_FeltOut,	0.05,	0.05 },
+		{ MAT_CatsEye, MAT_Felt,	0.025,	0.03 },
+		{ MAT_CatsEye, MAT_FeltOut,	0.06,	0.06 },
+		{ MAT_Tolley,  MAT_Felt,	0.1,	0.05 },
+		{ MAT_Tolley,  MAT_FeltOut,	0.2,	0.1 },
+	};
+	for (i = 0; i < (int)(sizeof(rolling)/sizeof(rolling[0])); i++) {
+		dSurfaceParameters s = base;
+		s.mode |= dContactRolling;
+		s.rho = s.rho2 = rolling[i].rho;
+		s.rhoN = rolling[i].rhoN;
+		setSurface(rolling[i].ball, rolling[i].floor, s);
+	}
+}
+
+void ODEManager::setSurface(SurfaceMaterial m1, SurfaceMaterial m2, const dSurfaceParameters& surface)
+{
+	m_surfaces[m1][m2] = surface;
+	m_surfaces[m2][m1] = surface;
+}
+
+// the one floor geom covers both sides of the ring
+static inline SurfaceMaterial FeltAt(SurfaceMaterial m, const dReal* pos)
+{
+	if (m == MAT_Felt && pos[0]*pos[0] + pos[2]*pos[2] > RING_RADIUS*RING_RADIUS)
+		return MAT_FeltOut;
+	return m;
+}
+
+void ODEManager::SetContactSurface(dContact& contact, SurfaceMaterial m1, SurfaceMaterial m2)
+{
+	contact.surface = m_surfaces[FeltAt(m1, contact.geom.pos)][FeltAt(m2, contact.geom.pos)];
+}
+
 //-------------------------------------------------------------------
 //	Call back function called when two bodies are near collision
 //-------------------------------------------------------------------
 
 void ODEManager::NearCallback (void *data, dGeomID o1, dGeomID o2)
 {
-	int i;
+	// dSpaceCollide2 hands us a space when one overlaps a geom; look inside
+	if (dGeomIsSpace(o1) || dGeomIsSpace(o2)) {
+		dSpaceCollide2 (o1,o2,data,&ODEManager::StaticCallback);
+		return;
+	}
+
 	// if (o1->body && o2->body) return;
 
 	// exit without doing anything if the two bodies are connected by a joint
 	
 	dBodyID b1 = dGeomGetBody(o1);
 	dBodyID b2 = dGeomGetBody(o2);
+	// nothing to do between sleepers and the table
+	if (!(b1 && dBodyIsEnabled(b1)) && !(b2 && dBodyIsEnabled(b2))) return;
 	if (b1 && b2 && dAreConnectedExcluding (b1,b2,dJointTypeContact)) return;
-	if (o1 != m_plane && o2 != m_plane)
-		CGame::Instance().CheckCollisions(b1, b2);
-	dContact contact[MAX_CONTACTS];   // up to MAX_CONTACTS contacts per box-box
-	for (i=0; i<MAX_CONTACTS; i++) {
-		contact[i].surface.mode = dContactBounce | dContactApprox1; // | dContactSoftCFM;
-		contact[i].surface.mu = dInfinity;
-		contact[i].surface.mu2 = dInfinity;
-		contact[i].surface.bounce = 0.75f;
-		contact[i].surface.bounce_vel = 0.1;
-		//contact[i].surface.soft_cfm = 0.01;
-	}
-
-	if (int numc = dCollide (o1,o2,MAX_CONTACTS,&contact[0].geom, sizeof(dContact))) 
-	{   
-		//if(CGame::Instance().onCollision(b1, b2)==true)
-		
-		dMatrix3 RI;
-		dRSetIdentity (RI);
-		const dReal ss[3] = {0.02,0.02,0.02};
-		for (i=0; i<numc; i++) 
-		{
-			dJointID c = dJointCreateContact (m_world,m_contactgroup,contact+i);
-			dJointAttach (c,b1,b2);			
+
+	// marble/marble and marble/floor are solved in bulk after the
+	// broadphase, the rest by dCollide; both in Narrowphase
+	if (m_narrowphase.AddPair(o1, o2)) return;
+	GeomPair pair;
+	pair.o1 = o1;
+	pair.o2 = o2;
+	m_pairs.push_back(pair);
+}
+
+//-------------------------------------------------------------------
+//	Broadphase
+//
+//	Each of ODE's spaces is its own broadphase; the uniform grid just
+//	walks a simple space's geoms.  Switching moves the geoms across.
+//	Only awake geoms are in it: they're tested against each other,
+//	then against the static and sleeping spaces with dSpaceCollide2.
+//	Static/static, static/sleeping and sleeping/sleeping pairs never
+//	come up at all.
+//-------------------------------------------------------------------
+
+void ODEManager::Broadphase()
+{
+	if (m_broadphase == BP_UniformGrid)
+		m_grid.Collide (m_space,this,&ODEManager::StaticCallback);
+	else
+		dSpaceCollide (m_space,this,&ODEManager::StaticCallback);
+
+	dSpaceCollide2 ((dGeomID)m_space,(dGeomID)m_staticSpace,this,&ODEManager::StaticCallback);
+	if (dSpaceGetNumGeoms(m_sleepSpace) > 0)
+		dSpaceCollide2 ((dGeomID)m_space,(dGeomID)m_sleepSpace,this,&ODEManager::StaticCallback);
+}
+
+void ODEManager::setGeomAsleep(dGeomID geom, bool asleep)
+{
+	dSpaceID from = asleep ? m_space : m_sleepSpace;
+	dSpaceID to = asleep ? m_sleepSpace : m_space;
+	if (dGeomGetSpace(geom) != from) return;
+	dSpaceRemove(from, geom);
+	dSpaceAdd(to, geom);
+}
+
+const char* ODEManager::getBroadphaseName(BroadphaseType type)
+{
+	static const char* names[BP_NumBroadphases] = { "hash", "sap", "quadtree", "grid" };
+	return (type >= 0 && type < BP_NumBroadphases) ? names[type] : "unknown";
+}
+
+void ODEManager::setBroadphase(BroadphaseType type)
+{
+	if (type == m_broadphase) return;
+
+	dSpaceID space;
+	switch (type) {
+	case BP_SweepAndPrune:
+		space = dSweepAndPruneSpaceCreate(0, dSAP_AXES_XZY);
+		break;
+	case BP_QuadTree: {
+		// ODE's quadtree splits x and y, so it's only halving the height
+		// on our y-up table; still worth timing against the others
+		dVector3 centre = { 0, 0, 0 };
+		dVector3 extents = { QUADTREE_EXTENT, QUADTREE_EXTENT, QUADTREE_EXTENT };
+		space = dQuadTreeSpaceCreate(0, centre, extents, QUADTREE_DEPTH);
+		break;
+	}
+	case BP_UniformGrid:
+		space = dSimpleSpaceCreate(0);
+		break;
+	default:
+		type = BP_HashSpace;
+		space = dHashSpaceCreate(0);
+		break;
+	}
+
+	// always the first: removing resets the space's geom cursor, so
+	// asking for any other index walks the list from the head again
+	while (dSpaceGetNumGeoms(m_space) > 0) {
+		dGeomID g = dSpaceGetGeom(m_space, 0);
+		dSpaceRemove(m_space, g);
+		dSpaceAdd(space, g);
+	}
+	dSpaceDestroy(m_space);
+	m_space = space;
+	m_broadphase = type;
+}
+
+//-------------------------------------------------------------------
+//	Each pass is the work a step does up to making contacts, the whole
+//	narrowphase included, since a broadphase that keeps more pairs
+//	costs there too.  The quickest pass of each stands, which is the
+//	least disturbed by whatever else the machine was doing, and the
+//	current one is only dropped for a clear TUNE_MARGIN win.
+//-------------------------------------------------------------------
+BroadphaseType ODEManager::AutoTuneBroadphase()
+{
+	BroadphaseType current = m_broadphase;
+	for (int type = 0; type < BP_NumBroadphases; type++) {
+		setBroadphase((BroadphaseType)type);
+
+		double fastest = 0;
+		for (int i = 0; i < TUNE_ITERATIONS; i++) {
+			double start = CTimer::getSeconds();
+			m_narrowphase.Clear();
+			m_pairs.clear();
+			Broadphase();
+			FindContacts();
+			double pass = CTimer::getSeconds() - start;
+			if (i == 0 || pass < fastest) fastest = pass;
+		}
+		m_broadphaseTime[type] = fastest;
+	}
+	m_narrowphase.Clear();
+	m_pairs.clear();
+
+	BroadphaseType best = current;
+	for (int type = 0; type < BP_NumBroadphases; type++)
+		if (m_broadphaseTime[type]*TUNE_MARGIN < m_broadphaseTime[best])
+			best = (BroadphaseType)type;
+	setBroadphase(best);
+	return best;
+}
+
+//-------------------------------------------------------------------
+//	Narrowphase
+//
+//	Finds the contacts for every pair the broadphase kept, split into
+//	tasks for the worker pool: sphere pairs in SPHERE_CHUNK runs of
+//	the SIMD kernels, the rest GENERIC_CHUNK dCollides at a time into
+//	a buffer per task.  Then, on this thread, the contacts go into the
+//	arena in the order the broadphase found the pairs, so the joints
+//	come out the same whichever thread did the work.
+//-------------------------------------------------------------------
+
+void ODEManager::NarrowphaseTask(void* data, int task)
+{
+	ODEManager* m = (ODEManager*)data;
+	if (task < m->m_sphereTasks) {
+		int begin = task*SPHERE_CHUNK;
+		int end = begin + SPHERE_CHUNK;
+		if (end > m->m_narrowphase.getNumPairs()) end = m->m_narrowphase.getNumPairs();
+		m->m_narrowphase.Solve(begin, end);
+		return;
+	}
+
+	task -= m->m_sphereTasks;
+	std::vector<dContactGeom>& out = m->m_taskContacts[task];
+	out.clear();
+	int begin = task*GENERIC_CHUNK;
+	int end = begin + GENERIC_CHUNK;
+	if (end > (int)m->m_pairs.size()) end = m->m_pairs.size();
+	dContactGeom contact[MAX_CONTACTS];   // up to MAX_CONTACTS contacts per box-box
+	for (int i = begin; i < end; i++) {
+		int numc = dCollide(m->m_pairs[i].o1, m->m_pairs[i].o2, MAX_CONTACTS, contact, sizeof(dContactGeom));
+		m->m_pairContacts[i] = numc;
+		out.insert(out.end(), contact, contact + numc);
+	}
+}
+
+// runs the tasks, leaving the contacts in the task buffers and the
+// sphere narrowphase
+void ODEManager::FindContacts()
+{
+	int numGeneric = m_pairs.size();
+	m_genericTasks = (numGeneric + GENERIC_CHUNK - 1)/GENERIC_CHUNK;
+	m_narrowphase.Prepare();
+	m_sphereTasks = (m_narrowphase.getNumPairs() + SPHERE_CHUNK - 1)/SPHERE_CHUNK;
+	if ((int)m_taskContacts.size() < m_genericTasks)
+		m_taskContacts.resize(m_genericTasks);
+	if ((int)m_pairContacts.size() < numGeneric)
+		m_pairContacts.resize(numGeneric);
+
+	int numTasks = m_sphereTasks + m_genericTasks;
+	if (m_pool && numTasks > 1)
+		m_pool->Run(&ODEManager::NarrowphaseTask, this, numTasks);
+	else
+		for (int i = 0; i < numTasks; i++)
+			NarrowphaseTask(this, i);
+	m_sphereContacts = m_narrowphase.Pack();
+}
+
+void ODEManager::Narrowphase()
+{
+	CObjectManager& om = m_sim.getObjectManager();
+	int i, j;
+	FindContacts();
+
+	// dCollide pairs first, as they used to be made during the collide pass
+	int numGeneric = m_pairs.size();
+	int genericTasks = m_genericTasks;
+	int pair = 0;
+	for (int task = 0; task < genericTasks; task++) {
+		const std::vector<dContactGeom>& buffer = m_taskContacts[task];
+		int next = 0;
+		for (; pair < numGeneric && pair < (task + 1)*GENERIC_CHUNK; pair++) {
+			int numc = m_pairContacts[pair];
+			const dContactGeom* contact = numc ? &buffer[next] : 0;
+			next += numc;
+			if (!numc) continue;
+
+			dGeomID o1 = m_pairs[pair].o1;
+			dGeomID o2 = m_pairs[pair].o2;
+			dBodyID b1 = dGeomGetBody(o1);
+			dBodyID b2 = dGeomGetBody(o2);
+			m_events.Touch(b1, b2);
+			if (IsSubStepped(b1)) b1 = 0;
+			if (IsSubStepped(b2)) b2 = 0;
+			if (!om.ResolveContactSleep(b1, b2)) continue;
+
+			// the surfaces are only filled in for contacts we actually use
+			SurfaceMaterial m1 = getGeomMaterial(o1);
+			SurfaceMaterial m2 = getGeomMaterial(o2);
+			for (j = 0; j < numc; j++) {
+				dContact* c = m_contacts.Add(b1, b2);
+				c->geom = contact[j];
+				SetContactSurface(*c, m1, m2);
+			}
+		}
+	}
+
+	for (i = 0; i < m_sphereContacts; i++) {
+		const dContactGeom& geom = m_narrowphase.getContact(i);
+		dBodyID b1 = dGeomGetBody(geom.g1);
+		dBodyID b2 = dGeomGetBody(geom.g2);
+		m_events.Touch(b1, b2);
+		if (IsSubStepped(b1)) b1 = 0;
+		if (IsSubStepped(b2)) b2 = 0;
+		if (!om.ResolveContactSleep(b1, b2)) continue;
+		dContact* c = m_contacts.Add(b1, b2);
+		c->geom = geom;
+		SetContactSurface(*c, getGeomMaterial(geom.g1), getGeomMaterial(geom.g2));
+	}
+}
+
+//-------------------------------------------------------------------
+//	Snapshots
+//
+//	Between steps there are no contact joints and nothing else in
+//	ODE's world that a step reads besides the bodies, so the objects'
+//	records, the clock and who was touching whom are the lot.  That
+//	and the order each space keeps its geoms in, which is the order
+//	the broadphase finds pairs and so the order the solver gets them.
+//-------------------------------------------------------------------
+
+void ODEManager::SaveSnapshot(CSnapshot& snapshot)
+{
+	m_sim.getObjectManager().SaveState(snapshot);
+	m_events.SaveTouching(snapshot.touching);
+	snapshot.geomOrder.clear();
+	SaveGeomOrder(m_space, snapshot.geomOrder);
+	snapshot.numAwakeGeoms = snapshot.geomOrder.size();
+	SaveGeomOrder(m_sleepSpace, snapshot.geomOrder);
+	snapshot.simTime = m_simTime;
+	snapshot.stepSize = m_stepSize;
+	snapshot.step = m_events.getStep();
+}
+
+bool ODEManager::RestoreSnapshot(const CSnapshot& snapshot)
+{
+	CObjectManager& om = m_sim.getObjectManager();
+	if (!om.RestoreState(snapshot)) return false;
+	if (!snapshot.geomOrder.empty()) {
+		const unsigned int* order = &snapshot.geomOrder[0];
+		if (!RestoreGeomOrder(m_space, order, snapshot.numAwakeGeoms) ||
+			!RestoreGeomOrder(m_sleepSpace, order + snapshot.numAwakeGeoms,
+							  snapshot.geomOrder.size() - snapshot.numAwakeGeoms))
+			return false;
+	}
+	m_events.RestoreTouching(snapshot.touching, snapshot.step, om);
+	m_simTime = snapshot.simTime;
+	m_stepSize = snapshot.stepSize;
+	m_accumulator = 0;
+	m_interpAlpha = 1;
+	return true;
+}
+
+void ODEManager::SaveGeomOrder(dSpaceID space, std::vector<unsigned int>& out)
+{
+	int num = dSpaceGetNumGeoms(space);
+	for (int i = 0; i < num; i++) {
+		dBodyID body = dGeomGetBody(dSpaceGetGeom(space, i));
+		out.push_back(body ? (unsigned int)(size_t)dBodyGetData(body) : 0);
+	}
+}
+
+// false, with the space left as it is, if its geoms aren't the saved
+// ones, one to a handle
+bool ODEManager::RestoreGeomOrder(dSpaceID space, const unsigned int* handles, int num)
+{
+	CObjectManager& om = m_sim.getObjectManager();
+	if (dSpaceGetNumGeoms(space) != num) return false;
+	int i;
+	m_geomRank.assign(om.getNumObjects(), -1);
+	for (i = 0; i < num; i++) {
+		int index = om.getIndex((ObjectHandle)handles[i]);
+		if (index < 0 || m_geomRank[index] >= 0) return false;
+		m_geomRank[index] = i;
+	}
+	m_geomOrder.assign(num, (dGeomID)0);
+	bool inOrder = true;
+	for (i = 0; i < num; i++) {
+		dGeomID g = dSpaceGetGeom(space, i);
+		dBodyID body = dGeomGetBody(g);
+		if (!body) return false;
+		int index = om.getIndex((ObjectHandle)(size_t)dBodyGetData(body));
+		int rank = (index >= 0) ? m_geomRank[index] : -1;
+		if (rank < 0 || m_geomOrder[rank]) return false;
+		m_geomOrder[rank] = g;
+		if (rank != i) inOrder = false;
+	}
+	if (inOrder) return true;
+
+	// spaces don't agree on which end a new geom goes, so put them
+	// in one way round and if the first isn't first, the other
+	for (int pass = 0; pass < 2; pass++) {
+		while (dSpaceGetNumGeoms(space) > 0)
+			dSpaceRemove(space, dSpaceGetGeom(space, 0));
+		for (i = 0; i < num; i++)
+			dSpaceAdd(space, m_geomOrder[pass ? num - 1 - i : i]);
+		if (dSpaceGetGeom(space, 0) == m_geomOrder[0]) break;
+	}
+	return true;
+}
+
+void ODEManager::CopySettings(ODEManager& from)
+{
+	m_stepSize = from.m_stepSize;
+	m_adaptiveStep = from.m_adaptiveStep;
+	m_minStep = from.m_minStep;
+	m_maxStep = from.m_maxStep;
+	m_ccd = from.m_ccd;
+	setBroadphase(from.m_broadphase);
+}
+
+//-------------------------------------------------------------------
+//	Continuous collision
+//
+//	A full-power tolley covers several marble widths in a step, so at
+//	the start of the next one it can be clean through a marble without
+//	ever having overlapped it.  Any body that would go further than its
+//	radius in a step sweeps its sphere along its velocity, and whatever
+//	the sweep passes through (woken if need be) joins it in a group.
+//	The rest of the table is disabled while the group is stepped on its
+//	own in short enough sub-steps that nothing gets jumped.  Then the
+//	group sits out the main step, to the others as if it were static,
+//	so everybody still moves through exactly one step.
+//-------------------------------------------------------------------
+
+// does a sphere moving by d from p come within reach of q?
+static bool SweptSphereHit(const dReal* p, const dReal* d, dReal reach, const dReal* q)
+{
+	dReal dd = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+	dReal t = ((q[0] - p[0])*d[0] + (q[1] - p[1])*d[1] + (q[2] - p[2])*d[2])/dd;
+	if (t < 0) t = 0;
+	else if (t > 1) t = 1;
+	dReal x = p[0] + d[0]*t - q[0];
+	dReal y = p[1] + d[1]*t - q[1];
+	dReal z = p[2] + d[2]*t - q[2];
+	return x*x + y*y + z*z <= reach*reach;
+}
+
+// the flag lives in the object's state, so it follows it through a wake
+bool ODEManager::IsSubStepped(dBodyID body)
+{
+	if (!body || m_ccdGroup.empty()) return false;
+	CObjectManager& om = m_sim.getObjectManager();
+	int i = om.getIndex((ObjectHandle)(size_t)dBodyGetData(body));
+	return i >= 0 && om.getState().subStepped[i];
+}
+
+void ODEManager::SetSubStepped(dBodyID body, bool on)
+{
+	CObjectManager& om = m_sim.getObjectManager();
+	int i = om.getIndex((ObjectHandle)(size_t)dBodyGetData(body));
+	if (i >= 0) om.getState().subStepped[i] = on;
+}
+
+void ODEManager::SubStepFastBodies()
+{
+	CObjectManager& om = m_sim.getObjectManager();
+	CObjectState& s = om.getState();
+	int i, j;
+
+	m_ccdGroup.clear();
+	m_ccdSubSteps = 0;
+	dReal worst = 0;
+	m_ccdRadius.clear();
+	for (i = 0; i < om.getNumActive(); i++) {
+		const dReal* v = dBodyGetLinearVel(s.body[i]);
+		dReal travel = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2])*m_stepSize;
+		if (travel <= s.radius[i]) continue;
+		m_ccdGroup.push_back(s.body[i]);
+		m_ccdRadius.push_back(s.radius[i]);
+		s.subStepped[i] = 1;
+		if (travel/s.radius[i] > worst) worst = travel/s.radius[i];
+	}
+	m_ccdFast = m_ccdGroup.size();
+	if (!m_ccdFast) return;
+
+	// anything, awake or not, the fast ones could reach this step
+	for (i = 0; i < (int)s.size(); i++) {
+		if (!s.body[i] || s.subStepped[i]) continue;
+		const dReal* q = dBodyGetPosition(s.body[i]);
+		for (j = 0; j < m_ccdFast; j++) {
+			const dReal* p = dBodyGetPosition(m_ccdGroup[j]);
+			const dReal* v = dBodyGetLinearVel(m_ccdGroup[j]);
+			dVector3 d = { v[0]*m_stepSize, v[1]*m_stepSize, v[2]*m_stepSize };
+			if (SweptSphereHit(p, d, m_ccdRadius[j] + s.radius[i], q)) {
+				m_ccdGroup.push_back(s.body[i]);
+				s.subStepped[i] = 1;
+				break;
+			}
 		}
 	}
+	// waking shuffles the state, so only once we're done walking it
+	for (i = m_ccdFast; i < (int)m_ccdGroup.size(); i++) {
+		CGameObject* obj = om.getObject(m_ccdGroup[i]);
+		if (obj->isAsleep()) om.WakeObject(obj);
+	}
+
+	m_ccdFrozen.clear();
+	for (i = 0; i < om.getNumActive(); i++) {
+		if (s.subStepped[i]) continue;
+		dBodyDisable(s.body[i]);
+		m_ccdFrozen.push_back(s.body[i]);
+	}
+
+	// each sub-step moves the fastest body at most its radius
+	m_ccdSubSteps = (int)ceil(worst);
+	if (m_ccdSubSteps > CCD_MAX_SUBSTEPS) m_ccdSubSteps = CCD_MAX_SUBSTEPS;
+	dReal h = m_stepSize/m_ccdSubSteps;
+	int n = m_ccdGroup.size();
+	for (int step = 0; step < m_ccdSubSteps; step++) {
+		for (i = 0; i < n; i++) {
+			dGeomID g1 = om.getObject(m_ccdGroup[i])->getGeomID();
+			for (j = i + 1; j < n; j++)
+				SubStepContact(g1, om.getObject(m_ccdGroup[j])->getGeomID());
+			// and whatever it meets that isn't in the group, even if the
+			// sweep missed it (it bounced its way there)
+			dSpaceCollide2((dGeomID)m_staticSpace, g1, this, &ODEManager::SubStepCallback);
+			dSpaceCollide2((dGeomID)m_space, g1, this, &ODEManager::SubStepCallback);
+			dSpaceCollide2((dGeomID)m_sleepSpace, g1, this, &ODEManager::SubStepCallback);
+		}
+		dWorldStep(m_world, h);
+		dJointGroupEmpty(m_contactgroup);
+	}
+
+	// swap over: the group has had its step
+	for (i = 0; i < (int)m_ccdFrozen.size(); i++)
+		dBodyEnable(m_ccdFrozen[i]);
+	for (i = 0; i < n; i++)
+		dBodyDisable(m_ccdGroup[i]);
+}
+
+// pairs inside the group have been done already, one way round
+void ODEManager::SubStepCallback(void* data, dGeomID o1, dGeomID o2)
+{
+	ODEManager* ode = (ODEManager*)data;
+	if (ode->IsSubStepped(dGeomGetBody(o1)) && ode->IsSubStepped(dGeomGetBody(o2)))
+		return;
+	ode->SubStepContact(o1, o2);
+}
+
+// only the group moves during the sub-steps; anything else it touches
+// (the floor, an obstacle, a marble that's frozen or asleep) is
+// attached as the static world
+void ODEManager::SubStepContact(dGeomID o1, dGeomID o2)
+{
+	dContactGeom contact[MAX_CONTACTS];
+	int numc = dCollide(o1, o2, MAX_CONTACTS, contact, sizeof(dContactGeom));
+	if (!numc) return;
+
+	dBodyID b1 = dGeomGetBody(o1);
+	dBodyID b2 = dGeomGetBody(o2);
+	m_events.Touch(b1, b2);
+	SurfaceMaterial m1 = getGeomMaterial(o1);
+	SurfaceMaterial m2 = getGeomMaterial(o2);
+	for (int i = 0; i < numc; i++) {
+		dContact c;
+		c.geom = contact[i];
+		SetContactSurface(c, m1, m2);
+		dJointID joint = dJointCreateContact(m_world, m_contactgroup, &c);
+		dJointAttach(joint, IsSubStepped(b1) ? b1 : 0, IsSubStepped(b2) ? b2 : 0);
+	}
+}
+
+void ODEManager::ReleaseSubStepped()
+{
+	for (unsigned i = 0; i < m_ccdGroup.size(); i++) {
+		dBodyEnable(m_ccdGroup[i]);
+		SetSubStepped(m_ccdGroup[i], false);
+	}
 }
 
 //-----------------------------------------------------------------
@@ -4,33 +4,165 @@
 
 #define GPB 6			//geometries per body
 #define MAX_CONTACTS 6	// maximum number of contact points per body
+#define PHYSICS_STEP (0.05)	// default seconds of simulation per dWorldStep
+#define MAX_SUBSTEPS 5		// most steps we'll take to catch up in one frame
+#define MIN_STEP (0.01)		// adaptive step range
+#define MAX_STEP (PHYSICS_STEP)	// never longer than the fixed step, only shorter
+#define STEP_CFL (0.5)		// share of its radius a body may cover in an adaptive step
+#define STEP_RATE_WINDOW (1.0)	// seconds of wall time the step rate is taken over
+#define SPHERE_CHUNK 1024	// sphere pairs per narrowphase task (a multiple of 4)
+#define GENERIC_CHUNK 16	// dCollide pairs per narrowphase task
+#define STEP_BUFFERS 5		// groups of buffers a step's allocations are counted over
+#define TUNE_ITERATIONS 5	// collide passes per space when auto-tuning
+#define TUNE_MARGIN 1.1		// how much quicker another broadphase has to be to switch
+#define QUADTREE_EXTENT 64	// half-size of the quadtree's root cell
+#define QUADTREE_DEPTH 6
+#define CCD_MAX_SUBSTEPS 8	// most sub-steps for bodies too fast for one step
 
-#include "singleton.h"
+#include "CGridBroadphase.h"
+#include "CSphereNarrowphase.h"
+#include "CCollisionEvents.h"
+#include "CContactArena.h"
+#include "CIslands.h"
+#include "CThreads.h"
+#include "CObjectState.h"
+#include "CStateHash.h"
 
 #include <ode/ode.h>
+#include <vector>
 
-class ODEManager: public Singleton<ODEManager>
+// how candidate pairs are found each step
+typedef enum {
+	BP_HashSpace,		// ODE's multi-resolution hash space
+	BP_SweepAndPrune,	// ODE's SAP space, sorted along x then z
+	BP_QuadTree,		// ODE's quadtree space over the table
+	BP_UniformGrid,		// CGridBroadphase, for equal sized marbles
+	BP_NumBroadphases
+} BroadphaseType;
+
+class CSnapshot;
+class CMarbleSim;
+
+// one per CMarbleSim: the ODE world, its spaces and contacts
+class ODEManager
 {
 
 public:
 
-	ODEManager();
+	ODEManager(CMarbleSim& sim);
 	~ODEManager();
 
-	void SimLoop(bool pause);
+	// deltaT is the frame time to catch up on
+	void SimLoop(double deltaT, bool pause);
+	// runs exactly this many fixed steps, ignoring the frame timer
+	void Advance(int steps);
+
+	// fixed timestep controls
+	void	setStepSize(double step);
+	double	getStepSize() { return m_stepSize; }
+	void	setMaxSubSteps(int steps);
+	int		getMaxSubSteps() { return m_maxSubSteps; }
+
+	// with the adaptive step on, each step is sized so the fastest body
+	// covers STEP_CFL of its radius, within the range: short steps just
+	// after a shot, long ones while the table creeps to a stop.  The
+	// accumulator still drains step by step, whatever size they are.
+	void	setAdaptiveStep(bool on) { m_adaptiveStep = on; }
+	bool	getAdaptiveStep() { return m_adaptiveStep; }
+	void	setStepRange(double minStep, double maxStep);
+
+	// steps per second of wall time, and per second of simulated
+	// time, over the last STEP_RATE_WINDOW
+	double	getStepRate() { return m_stepRate; }
+	double	getSimStepRate() { return m_simStepRate; }
+	double	getSimTime() { return m_simTime; }		// seconds simulated in all
+	int		getStepCount() { return m_events.getStep(); }	// steps taken
+
+	// every step is hashed as it finishes; open the hash's log to
+	// keep them (see CStateHash)
+	CStateHash& getStateHash() { return m_stateHash; }
+	unsigned int getStepHash() { return m_stateHash.getHash(); }
+	// moves every awake geom into a space of the new type
+	void	setBroadphase(BroadphaseType type);
+	BroadphaseType getBroadphase() { return m_broadphase; }
+	static const char* getBroadphaseName(BroadphaseType type);
+
+	// times a few collide passes with each broadphase on the table as
+	// it is and keeps the fastest.  It's far too slow for the middle of
+	// a step, so call it between them with the table awake, like just
+	// after racking.
+	BroadphaseType AutoTuneBroadphase();
+	double	getBroadphaseTime(BroadphaseType type) { return m_broadphaseTime[type]; }
+
+	// contact parameters between two materials (symmetric)
+	void	setSurface(SurfaceMaterial m1, SurfaceMaterial m2, const dSurfaceParameters& surface);
+	const dSurfaceParameters& getSurface(SurfaceMaterial m1, SurfaceMaterial m2) { return m_surfaces[m1][m2]; }
+	static void setGeomMaterial(dGeomID geom, SurfaceMaterial m) { dGeomSetData(geom, (void*)(size_t)m); }
+	static SurfaceMaterial getGeomMaterial(dGeomID geom) { return (SurfaceMaterial)(size_t)dGeomGetData(geom); }
+
+	// who touched whom, drained once per step
+	CCollisionEvents& getEvents() { return m_events; }
+
+	// contact buffer, and heap allocations made by the last step: ODE's,
+	// the contact buffer's, and one for each of the step's other
+	// buffers (pairs, narrowphase, grid, events, islands) that had to
+	// grow; 0 once they've all warmed up
+	CContactArena& getContactArena() { return m_contacts; }
+	int		getStepAllocs() { return m_stepAllocs; }
+
+	// run the narrowphase and solve the step's islands on this many
+	// threads.  Contacts are put back together in broadphase order and
+	// islands don't interact, so the result is the same whatever the
+	// count.  The islands stay on one thread if ODE wasn't built with
+	// threading; isStepThreaded says whether they got it.
+	int		setThreadCount(int threads);
+	int		getThreadCount() { return m_threads; }
+	bool	isStepThreaded();
+	CIslands& getIslands() { return m_islands; }
+
+	// bodies that would cover more than their radius in a step are
+	// swept along their path, and they and whatever they'd hit get
+	// sub-stepped on their own before the rest of the table steps
+	void	setContinuousCollision(bool on) { m_ccd = on; }
+	bool	getContinuousCollision() { return m_ccd; }
+	int		getNumFastBodies() { return m_ccdFast; }		// last step
+	int		getNumSubStepped() { return m_ccdGroup.size(); }
+	int		getCCDSubSteps() { return m_ccdSubSteps; }
 
-	//  Have to have a static member for a callback, but 
-	//  I don't want to make all my member data static (we're a singleton anyways)
+	// the whole world between steps, objects included; see CSnapshot.
+	// Restoring needs the same objects to exist as when it was saved,
+	// with a geom each, and is false if they don't.
+	void	SaveSnapshot(CSnapshot& snapshot);
+	bool	RestoreSnapshot(const CSnapshot& snapshot);
+	// takes on another world's step settings, so a copy of it made
+	// from a snapshot goes exactly the way it would
+	void	CopySettings(ODEManager& from);
+
+	// how far we are between the last step and the next one (0-1),
+	// used by the objects to blend their transforms when drawing
+	double	getInterpAlpha() { return m_interpAlpha; }
+
+	//  Have to have a static member for a callback; the data is
+	//  the manager whose spaces are being collided
 	void NearCallback (void *data, dGeomID o1, dGeomID o2);
 	static void StaticCallback(void* data, dGeomID o1, dGeomID o2)
 	{ 
-		ODEManager::Instance().NearCallback(data,o1,o2);
+		((ODEManager*)data)->NearCallback(data,o1,o2);
 	}
 
+	// ODE keeps per thread data for collision; any thread but the one
+	// that called dInitODE has to attach before it steps a world
+	static void AttachThread();
+	static void DetachThread();
+
+	// a sleeping body's geom waits in a space of its own, which is only
+	// ever tested against the awake space
+	void	setGeomAsleep(dGeomID geom, bool asleep);
+
 	/*Wrapper ODE functions */
 	dBodyID		createBody();
 	dGeomID		createSphere(double radius);
-	dGeomID		createBox(double length, double width, double height);
+	dGeomID		createBox(double length, double width, double height);	// static obstacle
 	dGeomID		createGeomTransform();
 	dGeomID		createPlane(dReal a, dReal b, dReal c, dReal d); 
 
@@ -40,11 +172,92 @@ public:
 	/*Draw Stuff Methods - these are only temporary until we write our own renderer*/
 	static void setViewPoint(double xyz[3], double hpr[3]);
 private:
+	void Step();
+	double ChooseStepSize();
+	void UpdateStepRate();
+	void FindContacts();
+	void Narrowphase();
+	void Broadphase();
+	static void NarrowphaseTask(void* data, int task);
+	void SubStepFastBodies();
+	void SubStepContact(dGeomID o1, dGeomID o2);
+	static void SubStepCallback(void* data, dGeomID o1, dGeomID o2);
+	bool IsSubStepped(dBodyID body);
+	void SetSubStepped(dBodyID body, bool on);
+	void ReleaseSubStepped();
+	void SaveGeomOrder(dSpaceID space, std::vector<unsigned int>& out);
+	bool RestoreGeomOrder(dSpaceID space, const unsigned int* handles, int num);
+	void GetStepCapacities(size_t* capacity);
+	void InitSurfaces();
+	void SetContactSurface(dContact& contact, SurfaceMaterial m1, SurfaceMaterial m2);
+
+	CMarbleSim&		m_sim;
 	dGeomID			m_plane;
 	dWorldID		m_world;
-	dSpaceID		m_space;
+	dSpaceID		m_space;			// awake geoms, the broadphase's space
+	dSpaceID		m_sleepSpace;		// geoms of sleeping bodies
+	dSpaceID		m_staticSpace;		// floor and obstacles, never collided with itself
 	dJointGroupID	m_contactgroup;
 	double			m_gravity[3];
+
+	double			m_stepSize;			// the next step's
+	double			m_lastStepSize;		// the one just taken
+	double			m_accumulator;
+	double			m_interpAlpha;
+	int				m_maxSubSteps;
+	bool			m_adaptiveStep;
+	double			m_minStep;
+	double			m_maxStep;
+	double			m_simTime;
+	double			m_stepRate;
+	double			m_simStepRate;
+	double			m_rateStart;		// wall time the rate window opened
+	double			m_rateSimStart;
+	int				m_rateSteps;
+
+	BroadphaseType	m_broadphase;
+	double			m_broadphaseTime[BP_NumBroadphases];	// seconds per pass, last tune
+	CGridBroadphase	m_grid;
+	CSphereNarrowphase m_narrowphase;
+	CCollisionEvents m_events;
+	CStateHash		m_stateHash;
+	CContactArena	m_contacts;
+	int				m_stepAllocs;
+
+	// pairs dCollide has to handle, kept from the broadphase so the
+	// narrowphase can be shared out; each task writes its own buffer
+	struct GeomPair
+	{
+		dGeomID	o1, o2;
+	};
+	std::vector<GeomPair>	m_pairs;
+	std::vector<int>		m_pairContacts;		// contacts each pair made
+	std::vector< std::vector<dContactGeom> > m_taskContacts;
+	int				m_sphereTasks;
+	int				m_genericTasks;
+	int				m_sphereContacts;	// packed by the last FindContacts
+
+	// continuous collision: the fast bodies come first in the group
+	bool			m_ccd;
+	int				m_ccdFast;
+	int				m_ccdSubSteps;
+	std::vector<dBodyID>	m_ccdGroup;
+	std::vector<dBodyID>	m_ccdFrozen;
+	std::vector<dReal>		m_ccdRadius;		// of the fast ones
+
+	// for putting a space's geoms back in a snapshot's order
+	std::vector<int>		m_geomRank;		// by dense index
+	std::vector<dGeomID>	m_geomOrder;
+
+	CIslands		m_islands;
+	int				m_threads;
+	CWorkerPool*	m_pool;
+#ifdef MARBLES_ODE_THREADS
+	dThreadingImplementationID	m_threading;
+	dThreadingThreadPoolID		m_threadPool;
+#endif
+
+	dSurfaceParameters m_surfaces[MAT_NumMaterials][MAT_NumMaterials];
 };
 
 
@@ -24,7 +24,7 @@
 #define OBJECT_FACTORY_H
 
 
-#include <hash_map>
+#include <map>
 #include "MacroRepeat.h"
 
 
@@ -95,10 +95,17 @@ template <typename CtorSignature, typename UniqueIdType> class ObjectFactory;
       }                                                                                                     \
                                                                                                             \
    protected:                                                                                               \
-      std::hash_map<UniqueIdType, CreateObjectFunc> m_object_creator;                                            \
+      std::map<UniqueIdType, CreateObjectFunc> m_object_creator;                                                 \
    };
 
+#ifdef _MSC_VER
 MACRO_REPEAT(16, OBJECT_FACTORY)
+#else
+// gcc expands the comma separators too early for MACRO_REPEAT, and
+// the object manager only needs constructors taking the world
+OBJECT_FACTORY(0)
+OBJECT_FACTORY(1)
+#endif
 #undef OBJECT_FACTORY
 
 #endif
\ No newline at end of file
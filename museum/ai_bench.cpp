@@ -0,0 +1,75 @@
+//-------------------------------------------------------------------
+//	ai_bench.cpp
+//
+//	How much the computer player gets through on a settled table: at
+//	every difficulty, and on one thread and then all of them, how
+//	many shots it tried in its time, how good the best was and how
+//	many came out of the shot cache, and how long starting the search
+//	held up the caller (all a frame of the game ever waits for it).
+//	Then the same search again on the same table, which the cache
+//	should mostly answer.
+//
+//	usage: ai_bench [marbles] [seed]
+//-------------------------------------------------------------------
+
+#include "CMarbleSim.h"
+#include "CShotSearch.h"
+#include "CThreads.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SETTLE_STEPS	100
+
+static void Run(CMarbleSim& table, int numMarbles, int threads, AILevel level, unsigned int seed)
+{
+	CShotSearch search(threads);
+	search.CreateMarbles(numMarbles);
+	double budget = CShotSearch::getBudget(level);
+	double start = CTimer::getSeconds();
+	search.Begin(table, table.getTolley(), budget, seed);
+	double begin = CTimer::getSeconds() - start;
+	search.Wait();
+	double took = CTimer::getSeconds() - start;
+
+	const ShotChoice& best = search.getBest();
+	CShotCache& cache = search.getCache();
+	printf("%-7s %2d threads: %6d shots (%7.1f/s) in %.2f s, best %+d (%d hit, %d out, tolley %.1f from the middle), %.1f%% cached\n",
+		   CShotSearch::getLevelName(level), search.getNumThreads(), search.getNumTried(),
+		   search.getNumTried()/budget, took, best.value, best.hits, best.ringOuts, best.leave,
+		   cache.getHitRate()*100);
+	printf("%-7s %2d threads: Begin held the caller %.3f ms\n",
+		   CShotSearch::getLevelName(level), search.getNumThreads(), begin*1000);
+
+	cache.ResetStats();
+	search.Begin(table, table.getTolley(), budget, seed);
+	search.Wait();
+	printf("%-7s %2d threads: %6d shots again, %.1f%% cached, %d evicted\n",
+		   CShotSearch::getLevelName(level), search.getNumThreads(), search.getNumTried(),
+		   cache.getHitRate()*100, cache.getEvictions());
+}
+
+int main(int argc, char** argv)
+{
+	int numMarbles    = (argc > 1) ? atoi(argv[1]) : 25;
+	unsigned int seed = (argc > 2) ? atoi(argv[2]) : 1;
+
+	dInitODE();
+	{
+		CMarbleSim table;
+		table.CreateMarbles(numMarbles);
+		table.getODEManager().setAdaptiveStep(true);
+		table.getTolley()->setPos(-20, TOLLEY_RADIUS, 50);
+		table.Advance(SETTLE_STEPS);
+
+		for (int level = 0; level < AI_NumLevels; level++) {
+			Run(table, numMarbles, 1, (AILevel)level, seed);
+			if (GetNumCores() > 1)
+				Run(table, numMarbles, GetNumCores(), (AILevel)level, seed);
+		}
+	}
+	dCloseODE();
+	return 0;
+}
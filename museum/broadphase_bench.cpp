@@ -0,0 +1,91 @@
+//-------------------------------------------------------------------
+//	broadphase_bench.cpp
+//
+//	Times one collide pass of ODE's hash space against CGridBroadphase
+//	on the same scattered table, at a few marble counts.  Both sides
+//	run the pairs through dCollide, so the hit counts must match.
+//
+//	usage: broadphase_bench [iterations]
+//-------------------------------------------------------------------
+
+#include "CGridBroadphase.h"
+#include "CMarble.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#define DEFAULT_ITERATIONS 50
+#define TOLLEY_EVERY 25		// one tolley-sized marble per this many
+
+static void CountHits(void* data, dGeomID o1, dGeomID o2)
+{
+	dContactGeom contact;
+	if (dCollide(o1, o2, 1, &contact, sizeof(dContactGeom)))
+		(*(int*)data)++;
+}
+
+static double Now(CTimer& timer)
+{
+	timer.FrameUpdate();
+	return timer.getTime();
+}
+
+static void RunScene(int numMarbles, int iterations, CTimer& timer)
+{
+	dSpaceID space = dHashSpaceCreate(0);
+	dCreatePlane(space, 0, 1, 0, 0);
+
+	// scatter on the floor at about mid-game density, with some
+	// marbles touching so the narrowphase has real work to find
+	double side = sqrt((double)numMarbles)*MARBLE_RADIUS*5;
+	srand(1);
+	std::vector<dGeomID> geoms;
+	for (int i = 0; i < numMarbles; i++) {
+		double r = (i % TOLLEY_EVERY == 0) ? TOLLEY_RADIUS : MARBLE_RADIUS;
+		dGeomID g = dCreateSphere(space, r);
+		dGeomSetPosition(g, side*rand()/RAND_MAX - side/2, r*0.99, side*rand()/RAND_MAX - side/2);
+		geoms.push_back(g);
+	}
+
+	int hashHits = 0;
+	double start = Now(timer);
+	for (int i = 0; i < iterations; i++) {
+		hashHits = 0;
+		dSpaceCollide(space, &hashHits, &CountHits);
+	}
+	double hashTime = (Now(timer) - start)/iterations;
+
+	CGridBroadphase grid(2*TOLLEY_RADIUS);
+	int gridHits = 0;
+	start = Now(timer);
+	for (int i = 0; i < iterations; i++) {
+		gridHits = 0;
+		grid.Collide(space, &gridHits, &CountHits);
+	}
+	double gridTime = (Now(timer) - start)/iterations;
+
+	printf("%6d marbles: hash %9.1f us  grid %9.1f us  (x%.2f)  hits %d/%d%s\n",
+		   numMarbles, hashTime*1e6, gridTime*1e6,
+		   (gridTime > 0) ? hashTime/gridTime : 0.0,
+		   hashHits, gridHits, (hashHits == gridHits) ? "" : "  MISMATCH");
+
+	dSpaceDestroy(space);
+}
+
+int main(int argc, char** argv)
+{
+	int iterations = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+	if (iterations <= 0) iterations = DEFAULT_ITERATIONS;
+
+	dInitODE();
+	CTimer timer;
+	RunScene(25, iterations, timer);
+	RunScene(1000, iterations, timer);
+	RunScene(10000, iterations, timer);
+	dCloseODE();
+	return 0;
+}
@@ -0,0 +1,111 @@
+//-------------------------------------------------------------------
+//	hash_compare.cpp
+//
+//	Compares two state hash logs (marbles_headless -h/-H, or anything
+//	else with CStateHash open) step by step and reports the first
+//	step that differs.  If both logs have each body's hash it also
+//	names the first body, by handle, that's different or missing.
+//
+//	usage: hash_compare a.hash b.hash
+//	exits 0 if the runs match, 1 if they diverge, 2 on a bad log
+//-------------------------------------------------------------------
+
+#include "CStateHash.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define HANDLE_SLOT_MASK ((1 << 20) - 1)	// HANDLE_INDEX_MASK
+
+struct HashLog
+{
+	FILE*			file;
+	StateHashHeader	header;
+	StepHashRecord	step;
+	std::vector<BodyHashRecord> bodies;
+};
+
+static bool ByHandle(const BodyHashRecord& a, const BodyHashRecord& b)
+{
+	return a.handle < b.handle;
+}
+
+static bool OpenLog(HashLog& log, const char* fileName)
+{
+	log.file = fopen(fileName, "rb");
+	if (!log.file) return false;
+	return fread(&log.header, sizeof(log.header), 1, log.file) == 1 &&
+		   log.header.magic == STATE_HASH_MAGIC && log.header.version == STATE_HASH_VERSION;
+}
+
+// false at the end of the log
+static bool ReadStep(HashLog& log)
+{
+	if (fread(&log.step, sizeof(log.step), 1, log.file) != 1) return false;
+	if (!log.header.detail) return true;
+	log.bodies.resize(log.step.numBodies);
+	if (log.step.numBodies &&
+		(int)fread(&log.bodies[0], sizeof(BodyHashRecord), log.step.numBodies, log.file) != log.step.numBodies)
+		return false;
+	std::sort(log.bodies.begin(), log.bodies.end(), ByHandle);
+	return true;
+}
+
+static void ReportBody(HashLog& a, HashLog& b)
+{
+	unsigned int i = 0, j = 0;
+	while (i < a.bodies.size() || j < b.bodies.size()) {
+		if (j == b.bodies.size() || (i < a.bodies.size() && a.bodies[i].handle < b.bodies[j].handle)) {
+			printf("  body %u (slot %u) only moved in the first run\n",
+				   a.bodies[i].handle, a.bodies[i].handle & HANDLE_SLOT_MASK);
+			return;
+		}
+		if (i == a.bodies.size() || b.bodies[j].handle < a.bodies[i].handle) {
+			printf("  body %u (slot %u) only moved in the second run\n",
+				   b.bodies[j].handle, b.bodies[j].handle & HANDLE_SLOT_MASK);
+			return;
+		}
+		if (a.bodies[i].hash != b.bodies[j].hash) {
+			printf("  body %u (slot %u) first differs: %08x vs %08x\n", a.bodies[i].handle,
+				   a.bodies[i].handle & HANDLE_SLOT_MASK, a.bodies[i].hash, b.bodies[j].hash);
+			return;
+		}
+		i++;
+		j++;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: hash_compare a.hash b.hash\n");
+		return 2;
+	}
+	HashLog a, b;
+	if (!OpenLog(a, argv[1]) || !OpenLog(b, argv[2])) {
+		fprintf(stderr, "can't read a state hash log\n");
+		return 2;
+	}
+
+	int steps = 0;
+	for (;;) {
+		bool moreA = ReadStep(a);
+		bool moreB = ReadStep(b);
+		if (!moreA || !moreB) {
+			if (moreA != moreB)
+				printf("identical for %d steps, then the %s run stops\n", steps, moreA ? "second" : "first");
+			else
+				printf("identical for all %d steps\n", steps);
+			return (moreA != moreB) ? 1 : 0;
+		}
+		if (a.step.step != b.step.step || a.step.hash != b.step.hash) {
+			printf("diverged at step %d (after %d identical): %08x vs %08x, %d vs %d bodies moved\n",
+				   a.step.step, steps, a.step.hash, b.step.hash, a.step.numBodies, b.step.numBodies);
+			if (a.header.detail && b.header.detail)
+				ReportBody(a, b);
+			return 1;
+		}
+		steps++;
+	}
+}
@@ -0,0 +1,275 @@
+//-------------------------------------------------------------------
+//	headless.cpp
+//
+//	Command line driver for the simulation core.  Racks the marbles,
+//	lets them settle, fires a script of shots and runs each one until
+//	the table is still again, as fast as the CPU will go.
+//
+//	usage: marbles_headless [-n marbles] [-s script] [-m maxsteps] [-g]
+//							[-b hash|sap|quadtree|grid|auto] [-t threads] [-c] [-a]
+//							[-w replay | -r replay] [-h hashes | -H hashes]
+//
+//	-b picks the broadphase; auto times them all on the freshly racked
+//	table, before any steps.  -g is the same as -b grid.
+//	-t runs the narrowphase and solves the step's islands on that many threads.
+//	-c turns off continuous collision, to see what fast shots tunnel through.
+//	-a sizes each step from the fastest marble instead of the fixed step.
+//	-w records the run to a replay file; -r plays one back (the game's
+//	too) instead of racking and shooting.  Either way the run ends by
+//	printing a checksum of where everything stopped, which a replay
+//	has to match exactly.
+//	-h logs every step's state hash to a file for hash_compare; -H logs
+//	each body's too, so it can say which body went wrong first.  The
+//	timing at the end includes what hashing costs next to a step,
+//	which has to stay well under 1% for the hash to be left on.
+//
+//	A script has one shot per line (# starts a comment):
+//		tolleyX tolleyZ aimX aimZ [forwardX forwardY forwardZ sideX sideY sideZ]
+//-------------------------------------------------------------------
+
+#include "CMarbleSim.h"
+#include "CObjectManager.h"
+#include "CStateHash.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define DEFAULT_MARBLES 25
+#define DEFAULT_MAX_STEPS 20000
+#define HASH_REPEATS 1000		// times the state hash is run to time it
+
+struct Shot
+{
+	double tolleyX, tolleyZ;
+	double aimX, aimZ;
+	double forward[3];
+	double side[3];
+};
+
+class CImpactCounter : public CCollisionListener
+{
+public:
+	CImpactCounter() : m_impacts(0), m_ringOuts(0) {}
+	virtual void OnImpact(CMarble*, CMarble*, double) { m_impacts++; }
+	virtual void OnRingOut(CMarble*) { m_ringOuts++; }
+	int m_impacts;
+	int m_ringOuts;
+};
+
+static bool LoadScript(const char* fileName, std::vector<Shot>& shots)
+{
+	FILE* f = fopen(fileName, "r");
+	if (!f) return false;
+
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		char* hash = strchr(line, '#');
+		if (hash) *hash = 0;
+		Shot s;
+		memset(&s, 0, sizeof(s));
+		int n = sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+					   &s.tolleyX, &s.tolleyZ, &s.aimX, &s.aimZ,
+					   &s.forward[0], &s.forward[1], &s.forward[2],
+					   &s.side[0], &s.side[1], &s.side[2]);
+		if (n >= 4) shots.push_back(s);
+	}
+	fclose(f);
+	return true;
+}
+
+// steps until the table stops moving (or we give up), returns steps taken
+static int RunUntilSettled(CMarbleSim& sim, int maxSteps)
+{
+	int steps = 0;
+	do {
+		sim.Advance(1);
+		steps++;
+	} while (!sim.DynamicsDone() && steps < maxSteps);
+	return steps;
+}
+
+static void Usage()
+{
+	fprintf(stderr, "usage: marbles_headless [-n marbles] [-s script] [-m maxsteps] [-g]\n"
+					"                        [-b hash|sap|quadtree|grid|auto] [-t threads] [-c] [-a]\n"
+					"                        [-w replay | -r replay] [-h hashes | -H hashes]\n");
+	exit(1);
+}
+
+int main(int argc, char** argv)
+{
+	int numMarbles = DEFAULT_MARBLES;
+	int maxSteps = DEFAULT_MAX_STEPS;
+	const char* script = 0;
+	BroadphaseType broadphase = BP_HashSpace;
+	bool autoTune = false;
+	int threads = 1;
+	bool ccd = true;
+	bool adaptive = false;
+	const char* recordFile = 0;
+	const char* replayFile = 0;
+	const char* hashFile = 0;
+	bool hashDetail = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i+1 < argc)		numMarbles = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s") && i+1 < argc)	script = argv[++i];
+		else if (!strcmp(argv[i], "-m") && i+1 < argc)	maxSteps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-g"))				broadphase = BP_UniformGrid;
+		else if (!strcmp(argv[i], "-b") && i+1 < argc) {
+			const char* name = argv[++i];
+			autoTune = !strcmp(name, "auto");
+			int b;
+			for (b = 0; b < BP_NumBroadphases; b++)
+				if (!strcmp(name, ODEManager::getBroadphaseName((BroadphaseType)b))) break;
+			if (b == BP_NumBroadphases && !autoTune) Usage();
+			if (!autoTune) broadphase = (BroadphaseType)b;
+		}
+		else if (!strcmp(argv[i], "-t") && i+1 < argc)	threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-c"))				ccd = false;
+		else if (!strcmp(argv[i], "-a"))				adaptive = true;
+		else if (!strcmp(argv[i], "-w") && i+1 < argc)	recordFile = argv[++i];
+		else if (!strcmp(argv[i], "-r") && i+1 < argc)	replayFile = argv[++i];
+		else if (!strcmp(argv[i], "-h") && i+1 < argc)	hashFile = argv[++i];
+		else if (!strcmp(argv[i], "-H") && i+1 < argc) {
+			hashFile = argv[++i];
+			hashDetail = true;
+		}
+		else Usage();
+	}
+	// the tuner goes by the clock, so it wouldn't choose the same again
+	if (recordFile && (autoTune || replayFile)) Usage();
+
+	std::vector<Shot> shots;
+	if (script) {
+		if (!LoadScript(script, shots)) {
+			fprintf(stderr, "can't open script %s\n", script);
+			return 1;
+		}
+	} else {
+		// the opening break from the game's starting tolley position
+		Shot s;
+		memset(&s, 0, sizeof(s));
+		s.tolleyX = -20; s.tolleyZ = 50;
+		shots.push_back(s);
+	}
+
+	dInitODE();
+	{
+		CTimer timer;
+		CMarbleSim sim;
+		CImpactCounter counter;
+		sim.setCollisionListener(&counter);
+		sim.getODEManager().setBroadphase(broadphase);
+		sim.getODEManager().setThreadCount(threads);
+		sim.getODEManager().setContinuousCollision(ccd);
+		sim.getODEManager().setAdaptiveStep(adaptive);
+		if (threads > 1 && !sim.getODEManager().isStepThreaded())
+			fprintf(stderr, "ODE has no threaded stepping, islands stay on 1 thread\n");
+		if (hashFile && !sim.getODEManager().getStateHash().Open(hashFile, hashDetail)) {
+			fprintf(stderr, "can't write hashes to %s\n", hashFile);
+			return 1;
+		}
+
+		timer.FrameUpdate();
+		double start = timer.getTime();
+
+		CReplayRecorder recorder;
+		int totalSteps = 0;
+		if (replayFile) {
+			CReplayPlayer player;
+			if (!player.Open(replayFile)) {
+				fprintf(stderr, "can't open replay %s\n", replayFile);
+				return 1;
+			}
+			totalSteps = player.Play(sim);
+			if (totalSteps < 0) {
+				fprintf(stderr, "replay %s is damaged\n", replayFile);
+				return 1;
+			}
+			printf("replay: %d marbles, %d steps, %d impacts, %d out of the ring\n",
+				   player.getHeader().numMarbles, totalSteps, counter.m_impacts, counter.m_ringOuts);
+			shots.clear();
+		} else if (recordFile) {
+			// rand is never seeded here, so it starts from 1
+			if (!recorder.Open(recordFile, sim, 1, numMarbles)) {
+				fprintf(stderr, "can't write replay %s\n", recordFile);
+				return 1;
+			}
+			sim.setRecorder(&recorder);
+		}
+
+		if (!replayFile) sim.CreateMarbles(numMarbles);
+		if (autoTune) {
+			ODEManager& ode = sim.getODEManager();
+			BroadphaseType best = ode.AutoTuneBroadphase();
+			for (int b = 0; b < BP_NumBroadphases; b++)
+				printf("%-8s %9.1f us/step\n", ODEManager::getBroadphaseName((BroadphaseType)b),
+					   ode.getBroadphaseTime((BroadphaseType)b)*1e6);
+			printf("using the %s broadphase\n", ODEManager::getBroadphaseName(best));
+		}
+		if (!replayFile) {
+			totalSteps = RunUntilSettled(sim, maxSteps);
+			printf("rack: %d marbles settled in %d steps\n", numMarbles, totalSteps);
+		}
+
+		for (unsigned int i = 0; i < shots.size(); i++) {
+			const Shot& s = shots[i];
+			CTolley* tolley = sim.getTolley();
+			sim.PlaceTolley(tolley, s.tolleyX, TOLLEY_RADIUS, s.tolleyZ);
+
+			CVector3 forward(s.forward[0], s.forward[1], s.forward[2]);
+			CVector3 side(s.side[0], s.side[1], s.side[2]);
+			CVector3 aim(s.aimX - s.tolleyX, 0, s.aimZ - s.tolleyZ);
+			int impacts = counter.m_impacts;
+			int ringOuts = counter.m_ringOuts;
+			sim.ShootMarble(tolley, forward, side, aim);
+
+			double shotStart = sim.getODEManager().getSimTime();
+			int steps = RunUntilSettled(sim, maxSteps);
+			totalSteps += steps;
+			double shotTime = sim.getODEManager().getSimTime() - shotStart;
+			printf("shot %u: %d steps (%.1f s, %.0f steps per simulated s), %d impacts, %d out of the ring\n",
+				   i, steps, shotTime, steps/shotTime,
+				   counter.m_impacts - impacts, counter.m_ringOuts - ringOuts);
+		}
+
+		timer.FrameUpdate();
+		double wall = timer.getTime() - start;
+		double simTime = sim.getODEManager().getSimTime();
+		printf("total: %d steps, %.2f s simulated in %.3f s wall, %.0f steps/s\n",
+			   totalSteps, simTime, wall, (wall > 0) ? totalSteps/wall : 0.0);
+
+		// a step only hashes its awake bodies; every body is the worst case
+		CObjectManager& om = sim.getObjectManager();
+		CStateHash hash;
+		double hashStart = CTimer::getSeconds();
+		for (int i = 0; i < HASH_REPEATS; i++)
+			hash.Hash(om, om.getNumObjects(), i);
+		double hashTime = (CTimer::getSeconds() - hashStart)/HASH_REPEATS;
+		double stepTime = (totalSteps > 0) ? wall/totalSteps : 0;
+		printf("state hash: %.2f us for all %d bodies, %.3f%% of a step\n", hashTime*1e6,
+			   om.getNumObjects(), (stepTime > 0) ? hashTime/stepTime*100 : 0.0);
+
+		sim.setRecorder(0);
+		recorder.Close();
+		std::vector<CMarble*>& marbles = sim.getMarbles();
+		double sum = 0;
+		for (unsigned int i = 0; i < marbles.size(); i++) {
+			const double* pos = marbles[i]->getPos();
+			sum += pos[0]*(i+1) + pos[1] + pos[2]*(i+7);
+		}
+		printf("checksum: %.17g, last step hash %08x\n", sum, sim.getODEManager().getStepHash());
+
+		CContactArena& arena = sim.getODEManager().getContactArena();
+		printf("allocs: %d in the last step, %d heap / %d recycled in all, %d contacts high water\n",
+			   sim.getODEManager().getStepAllocs(), CContactArena::getHeapAllocs(),
+			   CContactArena::getRecycledAllocs(), arena.getHighWater());
+	}
+	dCloseODE();
+	return 0;
+}
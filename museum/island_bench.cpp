@@ -0,0 +1,109 @@
+//-------------------------------------------------------------------
+//	island_bench.cpp
+//
+//	Times the physics step on 1 to N threads (narrowphase and island
+//	solving; the islands only if ODE has threading), on a table of 1k and
+//	10k marbles scattered in small clumps and thrown at each other so
+//	there are plenty of islands.  Every run starts from the same
+//	table, and the final positions are checked against the one
+//	thread run; they have to match exactly.
+//
+//	usage: island_bench [steps] [max threads]
+//-------------------------------------------------------------------
+
+#include "CMarbleSim.h"
+#include "CObjectManager.h"
+#include "CThreads.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#define DEFAULT_STEPS 40
+#define CLUMP 4		// marbles per clump
+
+static double Now(CTimer& timer)
+{
+	timer.FrameUpdate();
+	return timer.getTime();
+}
+
+// runs the scene and returns seconds per step; sum is a position checksum
+static double RunScene(int numMarbles, int threads, int steps, CTimer& timer,
+					   double& sum, int& islands, bool& stepThreaded)
+{
+	CMarbleSim sim;
+	sim.getODEManager().setBroadphase(BP_UniformGrid);
+	sim.getODEManager().setThreadCount(threads);
+	stepThreaded = sim.getODEManager().isStepThreaded();
+	sim.CreateMarbles(numMarbles);
+
+	std::vector<CMarble*>& marbles = sim.getMarbles();
+	double side = sqrt((double)numMarbles/CLUMP)*MARBLE_RADIUS*12;
+	srand(1);
+	double cx = 0, cz = 0, vx = 0, vz = 0;
+	for (unsigned int i = 1; i < marbles.size(); i++) {
+		if (i % CLUMP == 1) {
+			cx = side*rand()/RAND_MAX - side/2;
+			cz = side*rand()/RAND_MAX - side/2;
+			vx = 4.0*rand()/RAND_MAX - 2;
+			vz = 4.0*rand()/RAND_MAX - 2;
+		}
+		int k = i % CLUMP;
+		marbles[i]->setPos(cx + k*MARBLE_RADIUS*2, MARBLE_RADIUS, cz);
+		marbles[i]->setVel(vx, 0, vz);
+	}
+
+	double start = Now(timer);
+	sim.Advance(steps);
+	double time = (Now(timer) - start)/steps;
+	islands = sim.getODEManager().getIslands().getNumIslands();
+
+	sum = 0;
+	for (unsigned int i = 0; i < marbles.size(); i++) {
+		const double* pos = marbles[i]->getPos();
+		sum += pos[0]*(i+1) + pos[1] + pos[2]*(i+7);
+	}
+	return time;
+}
+
+int main(int argc, char** argv)
+{
+	int steps = (argc > 1) ? atoi(argv[1]) : DEFAULT_STEPS;
+	int maxThreads = (argc > 2) ? atoi(argv[2]) : GetNumCores();
+	if (steps <= 0) steps = DEFAULT_STEPS;
+	if (maxThreads <= 0) maxThreads = 1;
+
+	// 1, 2, 4... and always the full count
+	std::vector<int> counts;
+	for (int t = 1; t < maxThreads; t *= 2)
+		counts.push_back(t);
+	counts.push_back(maxThreads);
+
+	dInitODE();
+	CTimer timer;
+	int scenes[] = { 1000, 10000 };
+	for (int s = 0; s < 2; s++) {
+		double base = 0, baseSum = 0;
+		for (unsigned int c = 0; c < counts.size(); c++) {
+			int t = counts[c];
+			double sum;
+			int islands;
+			bool stepThreaded;
+			double time = RunScene(scenes[s], t, steps, timer, sum, islands, stepThreaded);
+			if (t == 1) {
+				base = time;
+				baseSum = sum;
+			}
+			printf("%6d marbles: %2d threads %9.2f ms/step  (x%.2f)  %d islands%s%s\n",
+				   scenes[s], t, time*1e3, (time > 0) ? base/time : 0.0, islands,
+				   (t > 1 && !stepThreaded) ? "  (islands serial)" : "",
+				   (sum == baseSum) ? "" : "  MISMATCH");
+		}
+	}
+	dCloseODE();
+	return 0;
+}
@@ -0,0 +1,73 @@
+//-------------------------------------------------------------------
+//	lookup_bench.cpp
+//
+//	Times the body -> object lookup the collision code does for every
+//	contact, through the handle table and through a std::map like the
+//	one it replaced, with a few thousand collisions per step.
+//
+//	usage: lookup_bench [marbles] [collisions per step] [steps]
+//-------------------------------------------------------------------
+
+#include "CMarbleSim.h"
+#include "CObjectManager.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+
+static double Now(CTimer& timer)
+{
+	timer.FrameUpdate();
+	return timer.getTime();
+}
+
+int main(int argc, char** argv)
+{
+	int numMarbles = (argc > 1) ? atoi(argv[1]) : 1000;
+	int collisions = (argc > 2) ? atoi(argv[2]) : 5000;
+	int steps      = (argc > 3) ? atoi(argv[3]) : 200;
+
+	dInitODE();
+	{
+		CTimer timer;
+		CMarbleSim sim;
+		sim.CreateMarbles(numMarbles);
+
+		std::vector<CMarble*>& marbles = sim.getMarbles();
+		std::map<dBodyID, CGameObject*> oldMap;
+		for (unsigned int i = 0; i < marbles.size(); i++)
+			oldMap[marbles[i]->getBodyID()] = marbles[i];
+
+		// the same random contact pairs for both runs
+		srand(1);
+		std::vector<dBodyID> pairs;
+		for (int i = 0; i < collisions*2; i++)
+			pairs.push_back(marbles[rand() % marbles.size()]->getBodyID());
+
+		CObjectManager& objects = sim.getObjectManager();
+		size_t check = 0;
+		double start = Now(timer);
+		for (int s = 0; s < steps; s++)
+			for (int i = 0; i < collisions*2; i++)
+				check += (size_t)objects.getObject(pairs[i]);
+		double handleTime = Now(timer) - start;
+
+		size_t mapCheck = 0;
+		start = Now(timer);
+		for (int s = 0; s < steps; s++)
+			for (int i = 0; i < collisions*2; i++)
+				mapCheck += (size_t)oldMap.find(pairs[i])->second;
+		double mapTime = Now(timer) - start;
+
+		double lookups = (double)steps*collisions*2;
+		printf("%d marbles, %d collisions/step, %d steps\n", (int)marbles.size(), collisions, steps);
+		printf("handle table %6.1f ns/lookup  %7.1f us/step\n", handleTime/lookups*1e9, handleTime/steps*1e6);
+		printf("std::map     %6.1f ns/lookup  %7.1f us/step\n", mapTime/lookups*1e9, mapTime/steps*1e6);
+		if (check != mapCheck) printf("MISMATCH\n");
+	}
+	dCloseODE();
+	return 0;
+}
@@ -0,0 +1,108 @@
+//-------------------------------------------------------------------
+//	preview_bench.cpp
+//
+//	How long a player waits for the shot preview.  A racked table is
+//	settled, then the aim is swung across it one notch at a time, the
+//	preview refined once a "frame" under the budget as the game does.
+//	Reports how many frames each aim took to finish its path, the
+//	longest any one frame's refining took (setting the shot up is part
+//	of that, and has to fit the budget too), and whether the finished
+//	paths end where the real shots first hit.
+//
+//	usage: preview_bench [marbles] [aims] [budget ms]
+//-------------------------------------------------------------------
+
+#include "CMarbleSim.h"
+#include "CShotPreview.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SETTLE_STEPS 100
+
+// the real shot, to check the preview against
+class FirstHit : public CCollisionListener
+{
+public:
+	FirstHit(CTolley* tolley) : m_tolley(tolley), m_hit(false) {}
+	virtual void OnImpact(CMarble* m1, CMarble* m2, double speed)
+	{
+		if (m_hit || (m1 != m_tolley && m2 != m_tolley)) return;
+		m_hit = true;
+		const double* pos = m_tolley->getPos();
+		for (int i = 0; i < 3; i++) m_pos[i] = pos[i];
+	}
+	CTolley*	m_tolley;
+	bool		m_hit;
+	double		m_pos[3];
+};
+
+int main(int argc, char** argv)
+{
+	int numMarbles = (argc > 1) ? atoi(argv[1]) : 25;
+	int aims       = (argc > 2) ? atoi(argv[2]) : 20;
+	double budget  = ((argc > 3) ? atof(argv[3]) : 2.0)/1000.0;
+	if (aims <= 0) aims = 1;
+
+	dInitODE();
+	{
+		CMarbleSim table;
+		table.CreateMarbles(numMarbles);
+		table.getODEManager().setAdaptiveStep(true);
+		table.Advance(SETTLE_STEPS);
+
+		CShotPreview preview;
+		preview.CreateMarbles(numMarbles);
+		preview.setTable(table);
+
+		CVector3 tolleyPos(-20, TOLLEY_RADIUS, 50);
+		CVector3 none(0, 0, 0);
+		int totalFrames = 0, worstFrames = 0, matched = 0, hits = 0;
+		double worstFrame = 0;
+		for (int a = 0; a < aims; a++) {
+			CVector3 aim(20 + (a - aims/2)*0.1, 0, -50);
+			preview.Aim(tolleyPos, none, none, aim);
+
+			int frames = 0;
+			while (!preview.isDone()) {
+				double start = CTimer::getSeconds();
+				preview.Refine(budget);
+				double took = CTimer::getSeconds() - start;
+				if (took > worstFrame) worstFrame = took;
+				frames++;
+			}
+			totalFrames += frames;
+			if (frames > worstFrames) worstFrames = frames;
+
+			// the same shot in a world of its own
+			CMarbleSim real;
+			real.CreateMarbles(numMarbles);
+			CSnapshot snapshot;
+			table.getODEManager().SaveSnapshot(snapshot);
+			real.getODEManager().setAdaptiveStep(true);
+			real.getODEManager().RestoreSnapshot(snapshot);
+			FirstHit hit(real.getTolley());
+			real.setCollisionListener(&hit);
+			real.getTolley()->setPos(tolleyPos.x, tolleyPos.y, tolleyPos.z);
+			real.ShootMarble(real.getTolley(), none, none, aim);
+			for (int i = 0; i < PREVIEW_MAX_STEPS && !hit.m_hit; i++)
+				real.Advance(1);
+
+			if (hit.m_hit) hits++;
+			if (hit.m_hit == preview.hasContact() &&
+				(!hit.m_hit || (hit.m_pos[0] == preview.getContact()[0] &&
+								hit.m_pos[1] == preview.getContact()[1] &&
+								hit.m_pos[2] == preview.getContact()[2])))
+				matched++;
+		}
+
+		printf("%d aims at %.2f ms a frame, %d hit a marble\n", aims, budget*1000, hits);
+		printf("frames to a finished path: %.1f average, %d worst\n", (double)totalFrames/aims, worstFrames);
+		printf("longest frame %.3f ms\n", worstFrame*1000);
+		printf("previews matching the real shot: %d of %d\n", matched, aims);
+	}
+	dCloseODE();
+	return 0;
+}
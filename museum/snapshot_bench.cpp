@@ -0,0 +1,122 @@
+//-------------------------------------------------------------------
+//	snapshot_bench.cpp
+//
+//	Times saving and restoring the world on a racked table, then
+//	checks a restore is exact: the break is run on from a snapshot
+//	twice, and once more in a second world restored from it, and all
+//	three have to end with every body's position, rotation and
+//	velocities bit for bit the same, having made the same impacts.
+//
+//	usage: snapshot_bench [marbles] [repeats] [steps]
+//-------------------------------------------------------------------
+
+#include "CMarbleSim.h"
+#include "CObjectManager.h"
+#include "CSnapshot.h"
+#include "CStateHash.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static double Now(CTimer& timer)
+{
+	timer.FrameUpdate();
+	return timer.getTime();
+}
+
+// every marble's body in the order they were made, which is the same
+// in any world racked with as many
+static unsigned int Hash(std::vector<CMarble*>& marbles)
+{
+	unsigned int hash = 0;
+	for (unsigned int i = 0; i < marbles.size(); i++)
+		hash = CStateHash::Mix(hash ^ CStateHash::HashBody(marbles[i]->getBodyID())) + i;
+	return hash;
+}
+
+// a restore that lost track of who was touching would have resting
+// contacts start over, as impacts
+class CImpactCounter : public CCollisionListener
+{
+public:
+	CImpactCounter() : m_impacts(0) {}
+	virtual void OnImpact(CMarble* m1, CMarble* m2, double speed) { m_impacts++; }
+	int		m_impacts;
+};
+
+static void Run(CMarbleSim& sim, CImpactCounter& counter, int steps, unsigned int& hash, int& impacts)
+{
+	counter.m_impacts = 0;
+	sim.Advance(steps);
+	hash = Hash(sim.getMarbles());
+	impacts = counter.m_impacts;
+}
+
+int main(int argc, char** argv)
+{
+	int numMarbles = (argc > 1) ? atoi(argv[1]) : 25;
+	int repeats    = (argc > 2) ? atoi(argv[2]) : 10000;
+	int steps      = (argc > 3) ? atoi(argv[3]) : 100;
+	if (repeats <= 0) repeats = 1;
+
+	dInitODE();
+	{
+		CTimer timer;
+		CMarbleSim sim;
+		sim.CreateMarbles(numMarbles);
+		sim.Advance(steps);
+
+		// the opening break, a step in so the table is moving
+		CTolley* tolley = sim.getTolley();
+		tolley->setPos(-20, TOLLEY_RADIUS, 50);
+		CVector3 none(0, 0, 0);
+		CVector3 aim(20, 0, -50);
+		sim.ShootMarble(tolley, none, none, aim);
+		sim.Advance(1);
+
+		ODEManager& ode = sim.getODEManager();
+		CSnapshot snapshot;
+		double start = Now(timer);
+		for (int i = 0; i < repeats; i++)
+			ode.SaveSnapshot(snapshot);
+		double saveTime = (Now(timer) - start)/repeats;
+
+		start = Now(timer);
+		for (int i = 0; i < repeats; i++)
+			ode.RestoreSnapshot(snapshot);
+		double restoreTime = (Now(timer) - start)/repeats;
+
+		CImpactCounter counter;
+		sim.setCollisionListener(&counter);
+		unsigned int hash[3];
+		int impacts[3];
+		Run(sim, counter, steps, hash[0], impacts[0]);
+		if (!ode.RestoreSnapshot(snapshot)) printf("restore failed\n");
+		Run(sim, counter, steps, hash[1], impacts[1]);
+
+		CMarbleSim other;
+		other.CreateMarbles(numMarbles);
+		other.getODEManager().CopySettings(ode);
+		other.setCollisionListener(&counter);
+		if (!other.getODEManager().RestoreSnapshot(snapshot)) printf("restore into another world failed\n");
+		Run(other, counter, steps, hash[2], impacts[2]);
+
+		printf("%d objects, %d touching, %u bytes a snapshot\n", sim.getObjectManager().getNumObjects(),
+			   (int)snapshot.touching.size(),
+			   (unsigned int)(snapshot.bodies.size()*sizeof(BodySnapshot) +
+							  snapshot.touching.size()*sizeof(TouchingPair) +
+							  snapshot.geomOrder.size()*sizeof(unsigned int)));
+		printf("save    %8.2f us\n", saveTime*1e6);
+		printf("restore %8.2f us\n", restoreTime*1e6);
+		printf("%d steps on from the snapshot: %08x, %d impacts\n", steps, hash[0], impacts[0]);
+		printf("  again in this world:    %s\n",
+			   (hash[1] == hash[0] && impacts[1] == impacts[0]) ? "identical" : "MISMATCH");
+		printf("  in another world:       %s\n",
+			   (hash[2] == hash[0] && impacts[2] == impacts[0]) ? "identical" : "MISMATCH");
+	}
+	dCloseODE();
+	return 0;
+}
@@ -0,0 +1,98 @@
+//-------------------------------------------------------------------
+//	world_bench.cpp
+//
+//	Runs a batch of separate worlds, each its own racked table and
+//	break shot (aimed a little differently in every world), first
+//	one after another and then spread over a pool of threads.  Each
+//	world has to end up exactly where it did when it ran alone.
+//
+//	usage: world_bench [worlds] [steps] [threads]
+//-------------------------------------------------------------------
+
+#include "CMarbleSim.h"
+#include "CThreads.h"
+#include "CTimer.h"
+
+#include <ode/ode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define RACK_MARBLES 25
+#define SETTLE_STEPS 20
+
+struct WorldBatch
+{
+	int					steps;
+	std::vector<double>	sums;		// a position checksum per world
+};
+
+static double Now(CTimer& timer)
+{
+	timer.FrameUpdate();
+	return timer.getTime();
+}
+
+static void RunWorld(void* data, int world)
+{
+	WorldBatch* batch = (WorldBatch*)data;
+	CMarbleSim sim;
+	sim.CreateMarbles(RACK_MARBLES);
+	sim.Advance(SETTLE_STEPS);
+
+	CTolley* tolley = sim.getTolley();
+	tolley->setPos(-20, TOLLEY_RADIUS, 50);
+	CVector3 none(0, 0, 0);
+	CVector3 aim(20 + (world % 16)*0.1, 0, -50);
+	sim.ShootMarble(tolley, none, none, aim);
+	sim.Advance(batch->steps);
+
+	std::vector<CMarble*>& marbles = sim.getMarbles();
+	double sum = 0;
+	for (unsigned int i = 0; i < marbles.size(); i++) {
+		const double* pos = marbles[i]->getPos();
+		sum += pos[0]*(i+1) + pos[1] + pos[2]*(i+7);
+	}
+	batch->sums[world] = sum;
+}
+
+int main(int argc, char** argv)
+{
+	int worlds  = (argc > 1) ? atoi(argv[1]) : 32;
+	int steps   = (argc > 2) ? atoi(argv[2]) : 200;
+	int threads = (argc > 3) ? atoi(argv[3]) : GetNumCores();
+	if (worlds <= 0) worlds = 1;
+	if (threads <= 0) threads = 1;
+
+	dInitODE();
+	{
+		CTimer timer;
+		WorldBatch serial, parallel;
+		serial.steps = parallel.steps = steps;
+		serial.sums.resize(worlds);
+		parallel.sums.resize(worlds);
+
+		double start = Now(timer);
+		for (int w = 0; w < worlds; w++)
+			RunWorld(&serial, w);
+		double serialTime = Now(timer) - start;
+
+		CWorkerPool pool(threads, &ODEManager::AttachThread, &ODEManager::DetachThread);
+		start = Now(timer);
+		pool.Run(&RunWorld, &parallel, worlds);
+		double parallelTime = Now(timer) - start;
+
+		int mismatches = 0;
+		for (int w = 0; w < worlds; w++)
+			if (serial.sums[w] != parallel.sums[w]) mismatches++;
+
+		double total = (double)worlds*(steps + SETTLE_STEPS);
+		printf("%d worlds of %d marbles, %d steps each\n", worlds, RACK_MARBLES + 1, steps + SETTLE_STEPS);
+		printf("1 thread   %8.3f s  %9.0f steps/s\n", serialTime, total/serialTime);
+		printf("%d threads %s%8.3f s  %9.0f steps/s  (x%.2f)\n", threads, (threads < 10) ? " " : "",
+			   parallelTime, total/parallelTime, serialTime/parallelTime);
+		if (mismatches) printf("MISMATCH in %d worlds\n", mismatches);
+	}
+	dCloseODE();
+	return 0;
+}